@@ -0,0 +1,71 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * alloc_counter.cpp
+ * Replaces the global operator new and delete with versions that count allocations.
+ */
+
+#include "alloc_counter.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+    thread_local int64_t allocationCount = 0;
+
+    void* countedAllocate(size_t size) {
+        ++allocationCount;
+        return malloc(size > 0 ? size : 1);
+    }
+}
+
+// Number of heap allocations made through operator new by the calling thread
+int64_t threadAllocationCount() {
+    return allocationCount;
+}
+
+void* operator new(size_t size) {
+    void* p = countedAllocate(size);
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    void* p = countedAllocate(size);
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
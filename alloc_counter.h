@@ -0,0 +1,19 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * alloc_counter.h
+ * Counts heap allocations made through operator new, per thread, so the
+ * pipeline stages can report how many allocations each frame costs.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Number of heap allocations made through operator new by the calling thread
+// Which OpenCV allocations are counted depends on the platform. A Windows DLL build of OpenCV
+// has its own operator new, so nothing allocated inside it is counted. On Linux the shared
+// libraries use this replacement, so containers allocated inside OpenCV are counted too.
+// Image buffers come from cv::fastMalloc, which does not use operator new, and are never counted.
+int64_t threadAllocationCount();
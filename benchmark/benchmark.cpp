@@ -0,0 +1,525 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * benchmark.cpp
+ * Measures detection and pose estimation speed on synthetic frames, without a camera or window.
+ * Markers are drawn at known poses onto textured backgrounds, so every run sees the same scenes.
+ */
+
+#include "../detection.h"
+#include "../kinematics.h"
+#include "../profiler.h"
+#include "../tracking.h"
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/aruco.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    const char* about = "Synthetic marker detection benchmark";
+    const char* keys =
+        "{h        |              | Display help information }"
+        "{r        | vga,720p,1080p,4k | Comma-separated resolutions: vga, 720p, 1080p, 4k }"
+        "{m        | 1,4,16       | Comma-separated numbers of markers per frame }"
+        "{d        | 0,10         | Comma-separated dictionaries, numbered as in the tracker (-d) }"
+        "{n        | 100          | Timed runs per scenario }"
+        "{wu       | 10           | Untimed warm-up runs per scenario }"
+        "{f        | 8            | Distinct synthetic frames per scenario, cycled through by the runs }"
+        "{dp       |              | File of marker detector parameters }"
+        "{refine   |              | Corner refinement: CORNER_REFINE_NONE=0, CORNER_REFINE_SUBPIX=1,"
+        "CORNER_REFINE_CONTOUR=2, CORNER_REFINE_APRILTAG=3}"
+        "{ds       | 1            | Search for markers in a copy of each frame shrunk by this factor }"
+        "{tiles    | 1            | Split each frame into N by N overlapping tiles searched in parallel }"
+        "{seed     | 1            | Random seed for marker poses and backgrounds }"
+        "{o        |              | CSV results filename }"
+        "{kc       |              | Check the joint angle and marker rotation kernels against the "
+        "double-precision functions they replaced, then exit }";
+
+    // Side length of the synthetic markers in meters
+    const float markerLength = 0.05f;
+    // White margin around each marker, as a fraction of the marker side
+    const float quietZone = 0.25f;
+
+    // A synthetic frame and the IDs and positions of the markers drawn on it
+    struct SyntheticFrame {
+        Mat image;
+        vector<int> ids;
+        vector<Vec3d> tvecs;
+    };
+
+    // Timing and accuracy results of one scenario
+    struct ScenarioResult {
+        string resolution;
+        int numMarkers = 0;
+        int dictionary = 0;
+        double fps = 0.0;
+        double meanMs = 0.0;
+        double p50Ms = 0.0;
+        double p99Ms = 0.0;
+        double maxMs = 0.0;
+        double detectionRate = 0.0;  // Fraction of drawn markers that were detected
+        double translationError = 0.0; // Mean distance from the drawn marker positions in mm
+    };
+
+    // Split a comma-separated option into its items
+    vector<string> splitList(const string& list) {
+        vector<string> items;
+        stringstream ss(list);
+        string item;
+        while(getline(ss, item, ',')) {
+            if(!item.empty())
+                items.push_back(item);
+        }
+        return items;
+    }
+
+    // Get the frame size of a named resolution, returns an empty size if the name is unknown
+    Size parseResolution(const string& name) {
+        if(name == "vga")
+            return Size(640, 480);
+        if(name == "720p")
+            return Size(1280, 720);
+        if(name == "1080p")
+            return Size(1920, 1080);
+        if(name == "4k")
+            return Size(3840, 2160);
+        return Size();
+    }
+
+    // Pinhole camera with a field of view similar to a webcam and no distortion
+    Mat syntheticCameraMatrix(Size frameSize) {
+        double f = 0.9 * frameSize.width;
+        return (Mat_<double>(3, 3) << f, 0, frameSize.width / 2.0, 0, f, frameSize.height / 2.0, 0, 0, 1);
+    }
+
+    // Smooth random texture, so thresholding sees gradients and clutter like a real background
+    Mat makeBackground(Size frameSize, RNG& rng) {
+        Mat noise(frameSize.height / 8 + 1, frameSize.width / 8 + 1, CV_8UC1);
+        rng.fill(noise, RNG::UNIFORM, 60, 200);
+
+        Mat background;
+        resize(noise, background, frameSize, 0, 0, INTER_CUBIC);
+        GaussianBlur(background, background, Size(5, 5), 0);
+        cvtColor(background, background, COLOR_GRAY2BGR);
+        return background;
+    }
+
+    // Warp a marker with its quiet zone onto the frame at a given pose
+    void drawMarkerAtPose(Mat& image, const Ptr<aruco::Dictionary>& dictionary, int id,
+                          const Mat& camMatrix, const Vec3d& rvec, const Vec3d& tvec) {
+        const int markerPixels = 200;
+        int marginPixels = (int) (markerPixels * quietZone);
+        int sidePixels = markerPixels + 2 * marginPixels;
+
+        Mat marker;
+        aruco::drawMarker(dictionary, id, markerPixels, marker, 1);
+        Mat markerImage(sidePixels, sidePixels, CV_8UC1, Scalar(255));
+        marker.copyTo(markerImage(Rect(marginPixels, marginPixels, markerPixels, markerPixels)));
+        cvtColor(markerImage, markerImage, COLOR_GRAY2BGR);
+
+        // Corners of the marker and quiet zone in the marker's own frame, in the same order
+        // as the image corners below (top left, top right, bottom right, bottom left)
+        float half = markerLength * (0.5f + quietZone);
+        vector<Point3f> objectCorners = {Point3f(-half, half, 0), Point3f(half, half, 0),
+                                         Point3f(half, -half, 0), Point3f(-half, -half, 0)};
+        vector<Point2f> imageCorners;
+        projectPoints(objectCorners, rvec, tvec, camMatrix, noArray(), imageCorners);
+
+        vector<Point2f> markerCorners = {Point2f(0, 0), Point2f((float) sidePixels, 0),
+                                         Point2f((float) sidePixels, (float) sidePixels),
+                                         Point2f(0, (float) sidePixels)};
+        Mat homography = getPerspectiveTransform(markerCorners, imageCorners);
+
+        Mat warped, mask;
+        warpPerspective(markerImage, warped, homography, image.size(), INTER_LINEAR);
+        warpPerspective(Mat(sidePixels, sidePixels, CV_8UC1, Scalar(255)), mask, homography,
+                        image.size(), INTER_NEAREST);
+        warped.copyTo(image, mask);
+    }
+
+    // Draw numMarkers markers on a grid of cells, each tilted by a random rotation
+    SyntheticFrame makeFrame(Size frameSize, const Ptr<aruco::Dictionary>& dictionary, int numMarkers,
+                             const Mat& camMatrix, RNG& rng) {
+        SyntheticFrame frame;
+        frame.image = makeBackground(frameSize, rng);
+
+        int cols = (int) ceil(sqrt((double) numMarkers));
+        int rows = (numMarkers + cols - 1) / cols;
+        double cellSize = min(frameSize.width / (double) cols, frameSize.height / (double) rows);
+        double f = camMatrix.at<double>(0, 0);
+        double cx = camMatrix.at<double>(0, 2);
+        double cy = camMatrix.at<double>(1, 2);
+
+        // Markers take up about half of their cell, so they do not overlap when tilted
+        double depth = f * markerLength / (0.5 * cellSize);
+
+        for(int i = 0; i < numMarkers; ++i) {
+            double u = (i % cols + 0.5) * frameSize.width / cols;
+            double v = (i / cols + 0.5) * frameSize.height / rows;
+
+            Vec3d tvec((u - cx) * depth / f, (v - cy) * depth / f, depth);
+            // Rodrigues vector of the marker facing the camera, then tilted up to about 30 degrees
+            Vec3d rvec(CV_PI + rng.uniform(-0.5, 0.5), rng.uniform(-0.5, 0.5), rng.uniform(-0.3, 0.3));
+
+            drawMarkerAtPose(frame.image, dictionary, i, camMatrix, rvec, tvec);
+            frame.ids.push_back(i);
+            frame.tvecs.push_back(tvec);
+        }
+
+        return frame;
+    }
+
+    // Detect and estimate the pose of markers in every frame, recording the time of each run
+    ScenarioResult runScenario(TrackerConfig& config, const vector<SyntheticFrame>& frames,
+                               int numRuns, int numWarmupRuns) {
+        LatencyHistogram latency;
+        FrameState state;
+        // Scenes are unrelated, so markers are not tracked between them
+        MarkerDetector markerDetector(config, false);
+        int drawnMarkers = 0;
+        int detectedMarkers = 0;
+        double totalError = 0.0;
+
+        int64_t startTime = nowNanoseconds();
+        for(int run = -numWarmupRuns; run < numRuns; ++run) {
+            const SyntheticFrame& frame = frames[(run + numWarmupRuns) % frames.size()];
+            if(run == 0)
+                startTime = nowNanoseconds();
+
+            state.reset();
+            state.image = frame.image;
+            state.index = run;
+
+            int64_t runStart = nowNanoseconds();
+            markerDetector.detect(state);
+            estimateFramePose(config, state);
+            int64_t runEnd = nowNanoseconds();
+
+            if(run < 0)
+                continue;
+            latency.record(runEnd - runStart);
+
+            // Compare detections with the drawn markers, IDs match their index in the frame
+            drawnMarkers += (int) frame.ids.size();
+            for(size_t i = 0; i < state.ids.size(); ++i) {
+                int id = state.ids[i];
+                if(id < 0 || id >= (int) frame.tvecs.size())
+                    continue;
+                ++detectedMarkers;
+                totalError += norm(state.tvecs[i] - frame.tvecs[id]) * 1000.0;
+            }
+        }
+        double elapsed = (nowNanoseconds() - startTime) / 1e9;
+
+        ScenarioResult result;
+        result.fps = numRuns / elapsed;
+        result.meanMs = latency.mean() / 1e6;
+        result.p50Ms = latency.percentile(0.50) / 1e6;
+        result.p99Ms = latency.percentile(0.99) / 1e6;
+        result.maxMs = latency.max() / 1e6;
+        result.detectionRate = drawnMarkers > 0 ? (double) detectedMarkers / drawnMarkers : 0.0;
+        result.translationError = detectedMarkers > 0 ? totalError / detectedMarkers : 0.0;
+        return result;
+    }
+
+    void writeResultsHeader(ostream& out) {
+        out << "Resolution,Markers,Dictionary,FPS,Mean (ms),p50 (ms),p99 (ms),Max (ms),"
+               "Detection Rate,Translation Error (mm)" << endl;
+    }
+
+    void writeResultRow(ostream& out, const ScenarioResult& result) {
+        out << result.resolution << "," << result.numMarkers << "," << result.dictionary << ","
+            << result.fps << "," << result.meanMs << "," << result.p50Ms << "," << result.p99Ms << ","
+            << result.maxMs << "," << result.detectionRate << "," << result.translationError << endl;
+    }
+
+    // Largest difference in degrees allowed between the angle kernels and the double-precision
+    // functions they replaced
+    const double maxKernelError = 0.001;
+    // Samples of each kind compared by the kernel check
+    const int kernelCheckSamples = 100000;
+
+    // Marker rotation as written before the kernels: Rodrigues in double precision, then the
+    // X-Y-Z Tait-Bryan conversion from euclideanspace.com, as bank, heading, and attitude
+    Vec3d referenceEuler(const Vec3d& rvec) {
+        Matx33d m;
+        Rodrigues(rvec, m);
+
+        if(m(1, 0) > 0.998)
+            return Vec3d(0, atan2(m(0, 2), m(2, 2)), CV_PI / 2) * (180.0 / CV_PI);
+        if(m(1, 0) < -0.998)
+            return Vec3d(0, atan2(m(0, 2), m(2, 2)), -CV_PI / 2) * (180.0 / CV_PI);
+        return Vec3d(atan2(-m(1, 2), m(1, 1)), atan2(-m(2, 0), m(0, 0)), asin(m(1, 0))) * (180.0 / CV_PI);
+    }
+
+    // Joint angle as written before the kernels, in double precision
+    double referenceJointAngle(const Vec3d& first, const Vec3d& vertex, const Vec3d& last) {
+        Vec3d v1 = first - vertex;
+        Vec3d v2 = last - vertex;
+        double cosine = v1.dot(v2) / (norm(v1) * norm(v2));
+        return acos(max(-1.0, min(cosine, 1.0))) * 180.0 / CV_PI;
+    }
+
+    // Difference between two angles in degrees, where angles a full turn apart are the same
+    double angleDifference(double a, double b) {
+        double difference = fmod(fabs(a - b), 360.0);
+        return min(difference, 360.0 - difference);
+    }
+
+    // Random unit vector, uniform over the sphere
+    Vec3d randomAxis(RNG& rng) {
+        double z = rng.uniform(-1.0, 1.0);
+        double azimuth = rng.uniform(-CV_PI, CV_PI);
+        double r = sqrt(1 - z * z);
+        return Vec3d(r * cos(azimuth), r * sin(azimuth), z);
+    }
+
+    // Rotation vector of the X-Y-Z Tait-Bryan angles in radians, found through the quaternion of
+    // the rotation about Y by heading, then Z by attitude, then X by bank
+    Vec3d eulerToRotationVector(double bank, double heading, double attitude) {
+        double c1 = cos(heading / 2), s1 = sin(heading / 2);
+        double c2 = cos(attitude / 2), s2 = sin(attitude / 2);
+        double c3 = cos(bank / 2), s3 = sin(bank / 2);
+        double w = c1 * c2 * c3 - s1 * s2 * s3;
+        Vec3d v(s1 * s2 * c3 + c1 * c2 * s3, s1 * c2 * c3 + c1 * s2 * s3, c1 * s2 * c3 - s1 * c2 * s3);
+        double length = norm(v);
+        if(length == 0)
+            return Vec3d();
+        return v * (2 * atan2(length, w) / length);
+    }
+
+    // Compare the joint angle and marker rotation kernels with the double-precision functions
+    // they replaced, on random rotations, rotations of nearly half a turn and nearly none,
+    // rotations near the gimbal poles, and random, nearly straight, and nearly folded joints
+    // Inputs are rounded to float as in the tracker, so the whole change to the written values
+    // is measured, returns false if any angle is off by more than maxKernelError
+    bool checkKernels(uint64 seed) {
+        RNG rng(seed);
+        const int n = kernelCheckSamples;
+
+        // Rotations, a quarter of each kind
+        vector<Vec3d> rvecs(n);
+        for(int i = 0; i < n; ++i) {
+            switch(i % 4) {
+            case 0:
+                rvecs[i] = randomAxis(rng) * rng.uniform(0.0, CV_PI);
+                break;
+            case 1:
+                rvecs[i] = randomAxis(rng) * (CV_PI - rng.uniform(0.0, 1e-3));
+                break;
+            case 2:
+                rvecs[i] = randomAxis(rng) * rng.uniform(0.0, 1e-4);
+                break;
+            default:
+                // Attitudes within 5 degrees of a pole, on both sides of the 0.998 threshold
+                double attitude = (CV_PI / 2 - rng.uniform(0.0, 5.0 * CV_PI / 180)) * (i % 8 == 3 ? 1 : -1);
+                rvecs[i] = eulerToRotationVector(rng.uniform(-CV_PI, CV_PI), rng.uniform(-CV_PI, CV_PI),
+                                                 attitude);
+            }
+        }
+
+        vector<float> rx(n), ry(n), rz(n), bank(n), heading(n), attitude(n);
+        for(int i = 0; i < n; ++i) {
+            rx[i] = (float) rvecs[i][0];
+            ry[i] = (float) rvecs[i][1];
+            rz[i] = (float) rvecs[i][2];
+        }
+        rotationVectorsToEuler(rx.data(), ry.data(), rz.data(), bank.data(), heading.data(),
+                               attitude.data(), n);
+
+        // Rotations right at the pole threshold can land on either side once rounded to float,
+        // where the conversion jumps, so they are left out
+        double rotationError = 0;
+        int thresholdSamples = 0;
+        for(int i = 0; i < n; ++i) {
+            Matx33d m;
+            Rodrigues(rvecs[i], m);
+            if(fabs(fabs(m(1, 0)) - 0.998) < 1e-5) {
+                ++thresholdSamples;
+                continue;
+            }
+
+            Vec3d expected = referenceEuler(rvecs[i]);
+            rotationError = max(rotationError, angleDifference(bank[i], expected[0]));
+            rotationError = max(rotationError, angleDifference(heading[i], expected[1]));
+            rotationError = max(rotationError, angleDifference(attitude[i], expected[2]));
+        }
+
+        // Joints, a third of each kind, with points up to half a meter from the camera axis
+        vector<Vec3d> points(3 * n);
+        vector<int> first(n), vertex(n), last(n);
+        for(int i = 0; i < n; ++i) {
+            Vec3d firstPoint(rng.uniform(-0.5, 0.5), rng.uniform(-0.5, 0.5), rng.uniform(0.3, 1.0));
+            Vec3d vertexPoint = firstPoint + randomAxis(rng) * rng.uniform(0.05, 0.3);
+            Vec3d lastDirection = randomAxis(rng);
+            if(i % 3 == 1)
+                lastDirection = normalize(vertexPoint - firstPoint + randomAxis(rng) * 1e-4);
+            else if(i % 3 == 2)
+                lastDirection = normalize(firstPoint - vertexPoint + randomAxis(rng) * 1e-4);
+
+            points[3 * i] = firstPoint;
+            points[3 * i + 1] = vertexPoint;
+            points[3 * i + 2] = vertexPoint + lastDirection * rng.uniform(0.05, 0.3);
+            first[i] = 3 * i;
+            vertex[i] = 3 * i + 1;
+            last[i] = 3 * i + 2;
+        }
+
+        vector<float> x(3 * n), y(3 * n), z(3 * n), angles(n);
+        for(size_t i = 0; i < points.size(); ++i) {
+            x[i] = (float) points[i][0];
+            y[i] = (float) points[i][1];
+            z[i] = (float) points[i][2];
+        }
+        vector<float> scratchData(6 * n);
+        float* scratch[6];
+        for(int i = 0; i < 6; ++i) {
+            scratch[i] = scratchData.data() + i * n;
+        }
+        computeJointAngles(x.data(), y.data(), z.data(), first.data(), vertex.data(), last.data(),
+                           scratch, angles.data(), n);
+
+        double jointError = 0;
+        for(int i = 0; i < n; ++i) {
+            double expected = referenceJointAngle(points[first[i]], points[vertex[i]], points[last[i]]);
+            jointError = max(jointError, fabs(angles[i] - expected));
+        }
+
+        cout << "Marker rotations: largest difference " << rotationError << " degrees over "
+             << n - thresholdSamples << " rotations (" << thresholdSamples
+             << " at the pole threshold left out)" << endl;
+        cout << "Joint angles: largest difference " << jointError << " degrees over " << n
+             << " joints" << endl;
+
+        bool passed = rotationError <= maxKernelError && jointError <= maxKernelError;
+        cout << (passed ? "Kernels are" : "Kernels are not") << " within " << maxKernelError
+             << " degrees of the double-precision functions" << endl;
+        return passed;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    CommandLineParser parser(argc, argv, keys);
+    parser.about(about);
+
+    if(parser.has("h")) {
+        parser.printMessage();
+        return 0;
+    }
+
+    vector<string> resolutions = splitList(parser.get<string>("r"));
+    vector<string> markerCounts = splitList(parser.get<string>("m"));
+    vector<string> dictionaries = splitList(parser.get<string>("d"));
+    int numRuns = parser.get<int>("n");
+    int numWarmupRuns = parser.get<int>("wu");
+    int numFrames = parser.get<int>("f");
+    int detectionScale = parser.get<int>("ds");
+    int detectionTiles = parser.get<int>("tiles");
+    uint64 seed = (uint64) parser.get<int>("seed");
+
+    Ptr<aruco::DetectorParameters> detectorParams = aruco::DetectorParameters::create();
+    if(parser.has("dp")) {
+        bool readOk = readDetectorParameters(parser.get<string>("dp"), detectorParams);
+        if(!readOk) {
+            cerr << "Invalid detector parameters file" << endl;
+            return 1;
+        }
+    }
+    if(parser.has("refine")) {
+        detectorParams->cornerRefinementMethod = parser.get<int>("refine");
+    }
+
+    if(!parser.check()) {
+        parser.printErrors();
+        return 1;
+    }
+
+    if(parser.has("kc")) {
+        return checkKernels(seed) ? 0 : 1;
+    }
+
+    if(numRuns < 1 || numWarmupRuns < 0 || numFrames < 1 || detectionScale < 1 || detectionTiles < 1) {
+        cerr << "Runs (-n), frames (-f), detection scale (-ds), and tiles (-tiles) must be positive and "
+                "warm-up runs (-wu) cannot be negative" << endl;
+        return 1;
+    }
+
+    ofstream outputFile;
+    if(parser.has("o")) {
+        outputFile.open(parser.get<string>("o"));
+        if(!outputFile.is_open()) {
+            cerr << "File \"" << parser.get<string>("o") << "\" failed to open" << endl;
+            return 1;
+        }
+        writeResultsHeader(outputFile);
+    }
+
+    writeResultsHeader(cout);
+
+    for(const string& resolution : resolutions) {
+        Size frameSize = parseResolution(resolution);
+        if(frameSize.area() == 0) {
+            cerr << "Unknown resolution \"" << resolution << "\"" << endl;
+            return 1;
+        }
+
+        for(const string& dictionaryName : dictionaries) {
+            int dictionaryID = atoi(dictionaryName.c_str());
+            if(dictionaryID < 0 || dictionaryID > aruco::DICT_APRILTAG_36h11) {
+                cerr << "Unknown dictionary " << dictionaryName << endl;
+                return 1;
+            }
+            Ptr<aruco::Dictionary> dictionary =
+                aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(dictionaryID));
+
+            for(const string& markerCount : markerCounts) {
+                int numMarkers = atoi(markerCount.c_str());
+                if(numMarkers < 1 || numMarkers > dictionary->bytesList.rows) {
+                    cerr << "Marker count " << markerCount << " is not between 1 and the dictionary size" << endl;
+                    return 1;
+                }
+
+                TrackerConfig config;
+                config.jointGraph = makeChainGraph(max(numMarkers - 2, 0));
+                // The tracker only searches for the IDs in its joint graph, which are the drawn
+                // markers here, and maps them back the same way
+                config.dictionary = restrictDictionary(dictionary, config.jointGraph.markerIDs);
+                config.dictionaryIDs = config.jointGraph.markerIDs;
+                config.detectorParams = detectorParams;
+                config.camMatrix = syntheticCameraMatrix(frameSize);
+                config.distCoeffs = Mat::zeros(1, 5, CV_64F);
+                config.markerLength = markerLength;
+                config.estimatePose = true;
+                config.detectionScale = detectionScale;
+                config.detectionTiles = detectionTiles;
+
+                // Every scenario gets the same scenes for the same seed
+                RNG rng(seed);
+                vector<SyntheticFrame> frames;
+                for(int i = 0; i < numFrames; ++i) {
+                    frames.push_back(makeFrame(frameSize, dictionary, numMarkers, config.camMatrix, rng));
+                }
+
+                ScenarioResult result = runScenario(config, frames, numRuns, numWarmupRuns);
+                result.resolution = resolution;
+                result.numMarkers = numMarkers;
+                result.dictionary = dictionaryID;
+
+                writeResultRow(cout, result);
+                if(outputFile.is_open()) {
+                    writeResultRow(outputFile, result);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * camera.cpp
+ * Contains the camera model with a precomputed undistortion grid.
+ */
+
+#include "camera.h"
+#include <opencv2/calib3d.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    // The full model is iterated far past what undistortPoints does by default, so the grid
+    // holds the points that the distortion model really maps to each pixel
+    const int exactIterations = 100;
+    const double exactEpsilon = 1e-12;
+}
+
+// Build a grid with points every gridSpacing pixels over images of the given size
+CameraModel::CameraModel(const Mat& camMatrix, const Mat& distCoeffs, Size imageSize, int gridSpacing)
+    : camMatrix(camMatrix.clone()), distCoeffs(distCoeffs.clone()), gridSpacing(gridSpacing) {
+    // One more grid point past the far edge, so every pixel is inside a cell
+    gridCols = (imageSize.width + gridSpacing - 1) / gridSpacing + 1;
+    gridRows = (imageSize.height + gridSpacing - 1) / gridSpacing + 1;
+
+    vector<Point2f> pixels;
+    pixels.reserve((size_t) gridCols * gridRows);
+    for(int y = 0; y < gridRows; ++y) {
+        for(int x = 0; x < gridCols; ++x) {
+            pixels.push_back(Point2f((float) (x * gridSpacing), (float) (y * gridSpacing)));
+        }
+    }
+    grid.resize(pixels.size());
+    undistortExact(pixels.data(), grid.data(), pixels.size());
+
+    measureError();
+}
+
+// Undistort pixel coordinates to normalized image coordinates by bilinear interpolation
+// between grid points, points outside of the grid are undistorted with the full model
+void CameraModel::undistort(const Point2f* pixels, Point2f* normalized, size_t count) const {
+    for(size_t i = 0; i < count; ++i) {
+        float gx = pixels[i].x / gridSpacing;
+        float gy = pixels[i].y / gridSpacing;
+        int x = (int) floor(gx);
+        int y = (int) floor(gy);
+
+        if(x < 0 || y < 0 || x >= gridCols - 1 || y >= gridRows - 1) {
+            undistortExact(&pixels[i], &normalized[i], 1);
+            continue;
+        }
+
+        float fx = gx - x;
+        float fy = gy - y;
+        const Point2f* row = &grid[(size_t) y * gridCols + x];
+        const Point2f* nextRow = row + gridCols;
+        Point2f top = row[0] * (1 - fx) + row[1] * fx;
+        Point2f bottom = nextRow[0] * (1 - fx) + nextRow[1] * fx;
+        normalized[i] = top * (1 - fy) + bottom * fy;
+    }
+}
+
+// Largest distance in pixels between interpolated and fully undistorted points,
+// measured at the center of every grid cell where interpolation is least accurate
+double CameraModel::maxError() const {
+    return maxGridError;
+}
+
+// Mean focal length in pixels, to turn normalized distances into pixels
+double CameraModel::focalLength() const {
+    return (camMatrix.at<double>(0, 0) + camMatrix.at<double>(1, 1)) / 2;
+}
+
+// Undistort points with the full model, iterating until they no longer move
+// The points are wrapped in Mat headers, so no buffers are allocated for them
+void CameraModel::undistortExact(const Point2f* pixels, Point2f* normalized, size_t count) const {
+    Mat pixelsMat((int) count, 1, CV_32FC2, const_cast<Point2f*>(pixels));
+    // The output already has the right size and type, so it is written in place
+    Mat normalizedMat((int) count, 1, CV_32FC2, normalized);
+    TermCriteria criteria(TermCriteria::COUNT | TermCriteria::EPS, exactIterations, exactEpsilon);
+    undistortPoints(pixelsMat, normalizedMat, camMatrix, distCoeffs, noArray(), noArray(), criteria);
+}
+
+void CameraModel::measureError() {
+    vector<Point2f> centers;
+    for(int y = 0; y < gridRows - 1; ++y) {
+        for(int x = 0; x < gridCols - 1; ++x) {
+            centers.push_back(Point2f((x + 0.5f) * gridSpacing, (y + 0.5f) * gridSpacing));
+        }
+    }
+
+    vector<Point2f> exact(centers.size());
+    vector<Point2f> interpolated(centers.size());
+    undistortExact(centers.data(), exact.data(), centers.size());
+    undistort(centers.data(), interpolated.data(), centers.size());
+
+    maxGridError = 0.0;
+    for(size_t i = 0; i < centers.size(); ++i) {
+        maxGridError = max(maxGridError, norm(interpolated[i] - exact[i]) * focalLength());
+    }
+}
@@ -0,0 +1,46 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * camera.h
+ * Contains a camera model that undistorts marker corners by looking them up in a precomputed
+ * grid, so poses can be solved in normalized image coordinates without a distortion model.
+ */
+
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Camera matrix and distortion coefficients with a grid of undistorted points
+// The grid is built once and only read afterwards, so a model can be shared by any threads
+class CameraModel {
+public:
+    // Build a grid with points every gridSpacing pixels over images of the given size
+    CameraModel(const cv::Mat& camMatrix, const cv::Mat& distCoeffs, cv::Size imageSize, int gridSpacing);
+
+    // Undistort pixel coordinates to normalized image coordinates by bilinear interpolation
+    // between grid points, points outside of the grid are undistorted with the full model
+    void undistort(const cv::Point2f* pixels, cv::Point2f* normalized, size_t count) const;
+
+    // Largest distance in pixels between interpolated and fully undistorted points,
+    // measured at the center of every grid cell where interpolation is least accurate
+    double maxError() const;
+    // Mean focal length in pixels, to turn normalized distances into pixels
+    double focalLength() const;
+
+private:
+    // Undistort points with the full model, iterating until they no longer move
+    // The points are wrapped in Mat headers, so no buffers are allocated for them
+    void undistortExact(const cv::Point2f* pixels, cv::Point2f* normalized, size_t count) const;
+    void measureError();
+
+    cv::Mat camMatrix;
+    cv::Mat distCoeffs;
+    int gridSpacing;
+    int gridCols;
+    int gridRows;
+    // Normalized coordinates of each grid point, row by row
+    std::vector<cv::Point2f> grid;
+    double maxGridError = 0.0;
+};
@@ -0,0 +1,188 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * capture.cpp
+ * Contains the frame ring buffer and capture thread implementations.
+ */
+
+#include "capture.h"
+#include <cmath>
+#include <utility>
+
+using namespace std;
+using namespace cv;
+
+FrameRingBuffer::FrameRingBuffer(size_t capacity, OverflowPolicy policy)
+    : slots(capacity > 0 ? capacity : 1), policy(policy) {}
+
+bool FrameRingBuffer::push(CapturedFrame& frame) {
+    unique_lock<std::mutex> lock(mutex);
+
+    if(policy == OVERFLOW_BLOCK) {
+        notFull.wait(lock, [this] { return count < slots.size() || closed; });
+    }
+
+    if(closed) {
+        return false;
+    }
+
+    if(count == slots.size()) {
+        // Drop the oldest frame, its slot is reused below
+        head = (head + 1) % slots.size();
+        --count;
+        ++dropped;
+    }
+
+    swap(slots[(head + count) % slots.size()], frame);
+    ++count;
+
+    lock.unlock();
+    notEmpty.notify_one();
+    return true;
+}
+
+bool FrameRingBuffer::pop(CapturedFrame& frame) {
+    unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return count > 0 || closed; });
+
+    if(count == 0) {
+        return false;
+    }
+
+    swap(slots[head], frame);
+    head = (head + 1) % slots.size();
+    --count;
+
+    lock.unlock();
+    notFull.notify_one();
+    return true;
+}
+
+void FrameRingBuffer::close() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    notEmpty.notify_all();
+    notFull.notify_all();
+}
+
+size_t FrameRingBuffer::size() const {
+    lock_guard<std::mutex> lock(mutex);
+    return count;
+}
+
+size_t FrameRingBuffer::capacity() const {
+    return slots.size();
+}
+
+size_t FrameRingBuffer::droppedFrames() const {
+    lock_guard<std::mutex> lock(mutex);
+    return dropped;
+}
+
+// Get the media time in seconds of the last frame grabbed from a video file
+// Falls back to the frame index and frame rate if the backend does not report timestamps
+double getMediaTime(const VideoCapture& inputVideo, int frameIndex, double fps) {
+    double msec = inputVideo.get(CAP_PROP_POS_MSEC);
+    if(msec > 0 || frameIndex == 0 || fps <= 0) {
+        return msec / 1000.0;
+    }
+    return frameIndex / fps;
+}
+
+// Grab the next frame, timing it in the profiler's grab stage if there is one
+bool grabFrame(VideoCapture& inputVideo, Profiler* profiler) {
+    ScopedStageTimer timer(profiler, STAGE_GRAB);
+    return inputVideo.grab();
+}
+
+// Decode the last grabbed frame, timing it in the profiler's retrieve stage if there is one
+void retrieveFrame(VideoCapture& inputVideo, Mat& image, Profiler* profiler) {
+    ScopedStageTimer timer(profiler, STAGE_RETRIEVE);
+    inputVideo.retrieve(image);
+}
+
+CollectionSchedule::CollectionSchedule(double collectionTime) : collectionTime(collectionTime) {}
+
+// Returns true if a frame with this time is the first frame of a new collection period
+bool CollectionSchedule::isCollectionFrame(double time) {
+    if(collectionTime <= 0)
+        return true;
+
+    int64_t period = (int64_t) floor(time / collectionTime);
+    if(period == lastPeriod)
+        return false;
+
+    lastPeriod = period;
+    return true;
+}
+
+CaptureThread::CaptureThread(VideoCapture& inputVideo, FrameRingBuffer& buffer, bool useMediaTime,
+                             double collectionTime, Profiler* profiler)
+    : inputVideo(inputVideo), buffer(buffer), useMediaTime(useMediaTime),
+      collectionTime(collectionTime), profiler(profiler), stopRequested(false), framesGrabbed(0) {}
+
+CaptureThread::~CaptureThread() {
+    stop();
+}
+
+void CaptureThread::start() {
+    stopRequested = false;
+    thread = std::thread(&CaptureThread::run, this);
+}
+
+void CaptureThread::stop() {
+    stopRequested = true;
+    buffer.close();
+    if(thread.joinable()) {
+        thread.join();
+    }
+}
+
+int64_t CaptureThread::grabbedFrames() const {
+    return framesGrabbed;
+}
+
+// Grab frames until the video ends or a stop is requested
+void CaptureThread::run() {
+    CapturedFrame frame;
+    if(profiler != nullptr) {
+        profiler->nameThread("Capture");
+    }
+
+    int frameIndex = 0;
+    int videoFrameIndex = 0;
+    double startTime = (double) getTickCount();
+
+    CollectionSchedule schedule(collectionTime);
+    double fps = useMediaTime ? inputVideo.get(CAP_PROP_FPS) : 0;
+
+    while(!stopRequested && grabFrame(inputVideo, profiler)) {
+        ++framesGrabbed;
+
+        // Video files are timed by their timestamps, so they can be processed at any speed
+        if(useMediaTime) {
+            frame.time = getMediaTime(inputVideo, videoFrameIndex, fps);
+        }
+        else {
+            frame.time = ((double) getTickCount() - startTime) / getTickFrequency();
+        }
+        ++videoFrameIndex;
+
+        // Skip decoding frames that fall between collection points
+        if(!schedule.isCollectionFrame(frame.time))
+            continue;
+
+        retrieveFrame(inputVideo, frame.image, profiler);
+        frame.index = frameIndex++;
+
+        if(!buffer.push(frame)) {
+            break;
+        }
+    }
+
+    // Let the consumer know that no more frames are coming
+    buffer.close();
+}
@@ -0,0 +1,118 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * capture.h
+ * Contains a fixed-capacity frame ring buffer and a thread that fills it
+ * from a video source, so the camera is drained while frames are processed.
+ */
+
+#pragma once
+
+#include "profiler.h"
+#include <opencv2/videoio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Action taken when a frame is pushed into a full ring buffer
+enum OverflowPolicy {
+    OVERFLOW_DROP_OLDEST = 0, // Discard the oldest queued frame (live cameras)
+    OVERFLOW_BLOCK = 1        // Wait until the consumer frees a slot (video files)
+};
+
+// A decoded frame and the time it was grabbed
+struct CapturedFrame {
+    cv::Mat image;
+    int index = 0;     // Number of frames delivered before this one
+    double time = 0.0; // Seconds since capture started, or media time for video files
+};
+
+// Fixed-capacity queue of frames shared by one producer and one consumer
+// Frames are swapped in and out of preallocated slots, so image buffers are recycled
+class FrameRingBuffer {
+public:
+    FrameRingBuffer(size_t capacity, OverflowPolicy policy);
+
+    // Move a frame into the buffer, leaving a recycled frame in its place
+    // Returns false if the buffer has been closed
+    bool push(CapturedFrame& frame);
+    // Wait for the oldest frame and move it out of the buffer
+    // Returns false once the buffer is closed and empty
+    bool pop(CapturedFrame& frame);
+    // Wake up all waiting threads and reject further pushes
+    void close();
+
+    size_t size() const;
+    size_t capacity() const;
+    size_t droppedFrames() const;
+
+private:
+    std::vector<CapturedFrame> slots;
+    OverflowPolicy policy;
+    size_t head = 0;
+    size_t count = 0;
+    size_t dropped = 0;
+    bool closed = false;
+
+    mutable std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+// Get the media time in seconds of the last frame grabbed from a video file
+// Falls back to the frame index and frame rate if the backend does not report timestamps
+double getMediaTime(const cv::VideoCapture& inputVideo, int frameIndex, double fps);
+
+// Grab the next frame, timing it in the profiler's grab stage if there is one
+bool grabFrame(cv::VideoCapture& inputVideo, Profiler* profiler);
+// Decode the last grabbed frame, timing it in the profiler's retrieve stage if there is one
+void retrieveFrame(cv::VideoCapture& inputVideo, cv::Mat& image, Profiler* profiler);
+
+// Selects the first frame of each collection period, so data is collected at a fixed rate
+class CollectionSchedule {
+public:
+    // Every frame is selected if the collection time is not positive
+    explicit CollectionSchedule(double collectionTime);
+
+    // Returns true if a frame with this time is the first frame of a new collection period
+    bool isCollectionFrame(double time);
+
+private:
+    double collectionTime;
+    int64_t lastPeriod = -1;
+};
+
+// Grabs and decodes frames on a separate thread and pushes them into a ring buffer
+class CaptureThread {
+public:
+    // If useMediaTime is set, frames are timed by their video timestamps instead of the clock
+    // If collectionTime is positive, only the first frame of each collection period is decoded,
+    // other frames are grabbed and skipped
+    // If profiler is not null, grabbing and decoding are timed
+    CaptureThread(cv::VideoCapture& inputVideo, FrameRingBuffer& buffer, bool useMediaTime = false,
+                  double collectionTime = 0, Profiler* profiler = nullptr);
+    ~CaptureThread();
+
+    void start();
+    // Stop capturing, close the buffer, and wait for the thread to exit
+    void stop();
+
+    // Number of frames grabbed so far, safe to call from any thread
+    int64_t grabbedFrames() const;
+
+private:
+    void run();
+
+    cv::VideoCapture& inputVideo;
+    FrameRingBuffer& buffer;
+    bool useMediaTime;
+    double collectionTime;
+    Profiler* profiler;
+    std::thread thread;
+    std::atomic<bool> stopRequested;
+    std::atomic<int64_t> framesGrabbed;
+};
@@ -0,0 +1,665 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * detection.cpp
+ * Contains the full-frame, tiled, region tracking, and optical flow marker detection steps.
+ */
+
+#include "detection.h"
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    // Smallest padding in pixels around a tracked marker, so small markers can still move
+    const int minRegionPadding = 8;
+    // Largest distance in pixels between a corner and where optical flow tracks it back to
+    const float maxFlowError = 1.0f;
+    // Largest mean corner movement in pixels of a base marker that is considered still
+    const double maxBaseMovement = 0.5;
+    // Half the side length in pixels of the image patches checked around locked base marker corners
+    const int basePatchRadius = 8;
+    // Lowest normalized correlation of a base marker corner patch with the locked patch
+    const double minPatchCorrelation = 0.9;
+    // Factor frames are shrunk by before being compared with the last processed frame,
+    // which averages out sensor noise as well as making the comparison cheap
+    const int motionScale = 8;
+
+    // Mean distance between corresponding corners of two markers
+    double meanCornerDistance(const vector<Point2f>& a, const vector<Point2f>& b) {
+        double distance = 0;
+        for(size_t i = 0; i < a.size(); ++i) {
+            distance += norm(a[i] - b[i]);
+        }
+        return distance / a.size();
+    }
+
+    // Index of a marker ID in a list of IDs, or -1 if it is not there
+    int findID(const vector<int>& ids, int id) {
+        auto it = find(ids.begin(), ids.end(), id);
+        return it != ids.end() ? (int) (it - ids.begin()) : -1;
+    }
+
+    // Returns true if two sets of marker corners are closer than a quarter of the marker size,
+    // so they must be the same marker found twice
+    bool isSameMarker(const vector<Point2f>& a, const vector<Point2f>& b) {
+        double perimeter = 0;
+        for(size_t i = 0; i < a.size(); ++i) {
+            perimeter += norm(a[i] - a[(i + 1) % a.size()]);
+        }
+        return meanCornerDistance(a, b) < perimeter / 16;
+    }
+
+    // Detect markers, copying out rejected candidates only if a list is given for them
+    // Markers of a dictionary restricted to a list of IDs are given their marker IDs
+    void findMarkers(const Mat& image, const TrackerConfig& config,
+                     const Ptr<aruco::DetectorParameters>& params, vector<vector<Point2f>>& corners,
+                     vector<int>& ids, vector<vector<Point2f>>* rejected) {
+        if(rejected != nullptr) {
+            aruco::detectMarkers(image, config.dictionary, corners, ids, params, *rejected);
+        }
+        else {
+            aruco::detectMarkers(image, config.dictionary, corners, ids, params, noArray());
+        }
+
+        if(!config.dictionaryIDs.empty()) {
+            for(int& id : ids) {
+                id = config.dictionaryIDs[id];
+            }
+        }
+    }
+}
+
+MarkerDetector::Workspace::Workspace()
+    : params(makePtr<aruco::DetectorParameters>()), scaledParams(makePtr<aruco::DetectorParameters>()) {}
+
+MarkerDetector::MarkerDetector(const TrackerConfig& config, bool consecutiveFrames)
+    : config(config), consecutiveFrames(consecutiveFrames), isBaseLocked(false), numFullScans(0),
+      numRegionScans(0), numFlowFrames(0), numReusedFrames(0),
+      frameParams(makePtr<aruco::DetectorParameters>()) {}
+
+// Detect markers in the frame image, frames must be passed in order if consecutiveFrames is set
+void MarkerDetector::detect(FrameState& frame) {
+    ScopedStageTimer timer(config.profiler, STAGE_DETECT, frame.index);
+
+    // Frames that look the same as the last processed frame get its markers and poses
+    bool useMotionGate = consecutiveFrames && config.motionThreshold > 0;
+    if(useMotionGate && isUnchanged(frame)) {
+        reuseLastResults(frame);
+        ++numReusedFrames;
+        return;
+    }
+
+    // The quality level is read once, so every search of this frame uses the same settings
+    applyQuality();
+
+    bool useFlow = consecutiveFrames && config.flowSearchInterval > 1;
+    bool useBaseLock = consecutiveFrames && config.baseLockFrames > 0;
+    if(useFlow || useBaseLock) {
+        if(frame.image.channels() == 3) {
+            cvtColor(frame.image, gray, COLOR_BGR2GRAY);
+        }
+        else {
+            frame.image.copyTo(gray);
+        }
+    }
+
+    // A locked base marker is left out of region tracking and optical flow, so if it may have
+    // moved, the whole frame is searched to find it again
+    if(isBaseLocked && !basePatchesMatch()) {
+        isBaseLocked = false;
+        baseStillFrames = 0;
+        forceFullScan = true;
+    }
+
+    // Searches run every few frames, or as soon as optical flow loses a marker
+    bool searched = false;
+    if(useFlow && !forceFullScan && framesSinceSearch < config.flowSearchInterval - 1 &&
+       followWithFlow(frame)) {
+        ++framesSinceSearch;
+    }
+    else {
+        search(frame);
+        searched = true;
+        framesSinceSearch = 0;
+    }
+
+    if(!consecutiveFrames)
+        return;
+
+    if(useBaseLock) {
+        updateBaseLock(frame, searched && lastSearchWasFull);
+    }
+
+    // Markers are tracked without the locked base marker, which is added back to every frame
+    lastIDs.clear();
+    lastCorners.resize(frame.corners.size());
+    size_t numTracked = 0;
+    for(size_t i = 0; i < frame.corners.size(); ++i) {
+        if(isBaseLocked && frame.ids[i] == 0)
+            continue;
+        lastIDs.push_back(frame.ids[i]);
+        lastCorners[numTracked++].assign(frame.corners[i].begin(), frame.corners[i].end());
+    }
+    lastCorners.resize(numTracked);
+
+    if(useFlow || useBaseLock) {
+        swap(gray, lastGray);
+    }
+
+    // Later frames are compared with this one, and get its markers if they have not changed
+    if(useMotionGate) {
+        heldIDs.assign(frame.ids.begin(), frame.ids.end());
+        heldCorners.resize(frame.corners.size());
+        for(size_t i = 0; i < frame.corners.size(); ++i) {
+            heldCorners[i].assign(frame.corners[i].begin(), frame.corners[i].end());
+        }
+        swap(motionImage, lastMotionImage);
+    }
+}
+
+// Copy the configured detector settings and lower their cost to the governor's quality level
+void MarkerDetector::applyQuality() {
+    int quality = config.governor != nullptr ? config.governor->level() : QUALITY_FULL;
+    *frameParams = *config.detectorParams;
+    detectionScale = config.detectionScale;
+
+    if(quality >= QUALITY_ONE_THRESHOLD) {
+        // Keep the window size in the middle of the configured range
+        int step = max(frameParams->adaptiveThreshWinSizeStep, 1);
+        int numSizes = (frameParams->adaptiveThreshWinSizeMax - frameParams->adaptiveThreshWinSizeMin) / step + 1;
+        int windowSize = frameParams->adaptiveThreshWinSizeMin + max(numSizes / 2, 0) * step;
+        frameParams->adaptiveThreshWinSizeMin = windowSize;
+        frameParams->adaptiveThreshWinSizeMax = windowSize;
+    }
+    if(quality >= QUALITY_NO_REFINEMENT) {
+        frameParams->cornerRefinementMethod = aruco::CORNER_REFINE_NONE;
+    }
+    // Corners found in shrunk frames are still refined at full resolution, since they could
+    // otherwise be off by a pixel of the shrunk frame
+    if(quality >= QUALITY_SHRUNK) {
+        detectionScale *= 2;
+    }
+}
+
+// Returns true if no pixel of the shrunk frame changed by the motion threshold or more
+// since the last processed frame
+bool MarkerDetector::isUnchanged(const FrameState& frame) {
+    ScopedTraceEvent event(config.profiler, "motion gate");
+
+    Size shrunkSize(max(frame.image.cols / motionScale, 1), max(frame.image.rows / motionScale, 1));
+    if(frame.image.channels() == 3) {
+        resize(frame.image, shrunkImage, shrunkSize, 0, 0, INTER_AREA);
+        cvtColor(shrunkImage, motionImage, COLOR_BGR2GRAY);
+    }
+    else {
+        resize(frame.image, motionImage, shrunkSize, 0, 0, INTER_AREA);
+    }
+
+    if(lastMotionImage.size() != motionImage.size())
+        return false;
+
+    return norm(motionImage, lastMotionImage, NORM_INF) < config.motionThreshold;
+}
+
+// Put the markers of the last processed frame into the frame, and mark its poses for reuse
+void MarkerDetector::reuseLastResults(FrameState& frame) {
+    // The frame is not searched, so it has no rejected candidates of its own, and pooled frames
+    // would otherwise keep those of an earlier frame
+    frame.rejected.clear();
+
+    frame.ids.assign(heldIDs.begin(), heldIDs.end());
+    frame.corners.resize(heldCorners.size());
+    for(size_t i = 0; i < heldCorners.size(); ++i) {
+        frame.corners[i].assign(heldCorners[i].begin(), heldCorners[i].end());
+    }
+
+    // Pose estimation copies the poses it found for the last frame, so held rows match it exactly
+    frame.posesReused = true;
+}
+
+// Search for markers in the whole frame or in regions around their last positions
+void MarkerDetector::search(FrameState& frame) {
+    bool fullScan = !consecutiveFrames || config.fullScanInterval <= 0 || lastCorners.empty() ||
+                    framesSinceFullScan >= config.fullScanInterval - 1 || forceFullScan;
+
+    // Search the whole frame again if a marker was lost, since it may have moved out of its region
+    if(!fullScan && !detectInRegions(frame)) {
+        fullScan = true;
+    }
+
+    if(fullScan) {
+        if(config.detectionTiles > 1) {
+            detectInTiles(frame);
+        }
+        else {
+            detectFullFrame(frame);
+        }
+        // A locked base marker is not searched for in regions, so it is never expected there
+        expectedIDs.clear();
+        for(int id : frame.ids) {
+            if(!(isBaseLocked && id == 0))
+                expectedIDs.push_back(id);
+        }
+        framesSinceFullScan = 0;
+        forceFullScan = false;
+    }
+    else {
+        ++framesSinceFullScan;
+    }
+    lastSearchWasFull = fullScan;
+}
+
+// Lock the base marker once it has stayed still, check it against a full search while locked,
+// and put its locked corners and pose into the frame
+void MarkerDetector::updateBaseLock(FrameState& frame, bool fullScan) {
+    int baseIndex = findID(frame.ids, 0);
+
+    if(!isBaseLocked) {
+        if(baseIndex < 0) {
+            baseStillFrames = 0;
+            return;
+        }
+
+        // Average the corners while the marker stays still, starting over whenever it moves
+        const vector<Point2f>& corners = frame.corners[baseIndex];
+        if(baseStillFrames == 0 || meanCornerDistance(corners, baseCorners) > maxBaseMovement) {
+            baseCorners.assign(corners.begin(), corners.end());
+            baseCornerSum.assign(corners.begin(), corners.end());
+            baseStillFrames = 1;
+            return;
+        }
+
+        for(size_t i = 0; i < corners.size(); ++i) {
+            baseCornerSum[i] += corners[i];
+        }
+        ++baseStillFrames;
+
+        if(baseStillFrames >= config.baseLockFrames) {
+            for(Point2f& corner : baseCornerSum) {
+                corner /= (float) baseStillFrames;
+            }
+            lockBase(baseCornerSum);
+        }
+        return;
+    }
+
+    // Full searches still find the base marker, so use them to check that it has not moved
+    if(fullScan && baseIndex >= 0 &&
+       meanCornerDistance(frame.corners[baseIndex], baseCorners) > 2 * maxBaseMovement) {
+        isBaseLocked = false;
+        baseStillFrames = 0;
+        return;
+    }
+
+    // Put the locked base marker first, replacing any detection of it
+    // Its entries are rotated to the front so the existing corner vectors are reused in place
+    if(baseIndex < 0) {
+        baseIndex = (int) frame.ids.size();
+        frame.ids.push_back(0);
+        frame.corners.emplace_back();
+    }
+    if(baseIndex > 0) {
+        rotate(frame.ids.begin(), frame.ids.begin() + baseIndex, frame.ids.begin() + baseIndex + 1);
+        rotate(frame.corners.begin(), frame.corners.begin() + baseIndex, frame.corners.begin() + baseIndex + 1);
+    }
+    frame.corners[0].assign(baseCorners.begin(), baseCorners.end());
+
+    frame.baseLocked = true;
+    frame.baseRvec = baseRvec;
+    frame.baseTvec = baseTvec;
+}
+
+void MarkerDetector::lockBase(const vector<Point2f>& corners) {
+    ScopedTraceEvent event(config.profiler, "lock base");
+
+    baseCorners.assign(corners.begin(), corners.end());
+
+    // Averaged corners give a steadier pose than any single frame
+    solveMarkerPose(config, baseCorners, baseRvec, baseTvec);
+
+    // Keep the image around each corner to check that the marker has not moved
+    Rect imageRect(0, 0, gray.cols, gray.rows);
+    basePatchRects.clear();
+    basePatches.clear();
+    for(const Point2f& corner : baseCorners) {
+        Rect patchRect((int) corner.x - basePatchRadius, (int) corner.y - basePatchRadius,
+                       2 * basePatchRadius + 1, 2 * basePatchRadius + 1);
+        patchRect &= imageRect;
+        if(patchRect.area() == 0) {
+            baseStillFrames = 0;
+            return;
+        }
+
+        basePatchRects.push_back(patchRect);
+        basePatches.push_back(gray(patchRect).clone());
+    }
+
+    isBaseLocked = true;
+}
+
+// Returns true if the image around each corner of the locked base marker has not changed
+bool MarkerDetector::basePatchesMatch() {
+    ScopedTraceEvent event(config.profiler, "check base");
+
+    for(size_t i = 0; i < basePatches.size(); ++i) {
+        matchTemplate(gray(basePatchRects[i]), basePatches[i], patchScore, TM_CCOEFF_NORMED);
+        if(!(patchScore.at<float>(0, 0) >= minPatchCorrelation))
+            return false;
+    }
+    return true;
+}
+
+// Returns false if a marker could not be followed from the previous frame
+bool MarkerDetector::followWithFlow(FrameState& frame) {
+    if(lastIDs.empty() || lastGray.size() != gray.size())
+        return false;
+
+    ScopedTraceEvent event(config.profiler, "optical flow", "markers", lastIDs.size());
+
+    // Followed frames are not searched, so they have no rejected candidates
+    frame.rejected.clear();
+    flowPoints.clear();
+    for(const vector<Point2f>& corners : lastCorners) {
+        flowPoints.insert(flowPoints.end(), corners.begin(), corners.end());
+    }
+
+    // Corners are tracked forward and then back, and a corner that does not return to where
+    // it started is treated as lost
+    Size windowSize(21, 21);
+    int maxLevel = 3;
+    calcOpticalFlowPyrLK(lastGray, gray, flowPoints, nextPoints, flowStatus, flowError, windowSize, maxLevel);
+    calcOpticalFlowPyrLK(gray, lastGray, nextPoints, backPoints, backStatus, flowError, windowSize, maxLevel);
+
+    for(size_t i = 0; i < flowPoints.size(); ++i) {
+        if(!flowStatus[i] || !backStatus[i] || norm(backPoints[i] - flowPoints[i]) > maxFlowError)
+            return false;
+    }
+
+    ++numFlowFrames;
+    frame.ids.assign(lastIDs.begin(), lastIDs.end());
+    frame.corners.resize(lastCorners.size());
+    for(size_t i = 0; i < lastCorners.size(); ++i) {
+        frame.corners[i].assign(nextPoints.begin() + 4 * i, nextPoints.begin() + 4 * i + 4);
+    }
+    return true;
+}
+
+int64_t MarkerDetector::fullScans() const {
+    return numFullScans;
+}
+
+int64_t MarkerDetector::regionScans() const {
+    return numRegionScans;
+}
+
+int64_t MarkerDetector::flowFrames() const {
+    return numFlowFrames;
+}
+
+int64_t MarkerDetector::reusedFrames() const {
+    return numReusedFrames;
+}
+
+bool MarkerDetector::baseLocked() const {
+    return isBaseLocked;
+}
+
+void MarkerDetector::detectFullFrame(FrameState& frame) {
+    ScopedTraceEvent event(config.profiler, "full scan");
+    ++numFullScans;
+
+    detectInImage(frame.image, frameParams, frameWorkspace, frame.corners, frame.ids, frame.rejected);
+}
+
+// Search overlapping tiles of the frame in parallel and merge their markers
+void MarkerDetector::detectInTiles(FrameState& frame) {
+    ScopedTraceEvent event(config.profiler, "tiled scan", "tiles", config.detectionTiles * config.detectionTiles);
+    ++numFullScans;
+
+    // Tiles overlap by a fraction of the frame, so any marker smaller than the overlap
+    // lies entirely inside at least one tile
+    int numTiles = config.detectionTiles;
+    int cols = frame.image.cols;
+    int rows = frame.image.rows;
+    int overlapX = (int) (cols * config.tileOverlap);
+    int overlapY = (int) (rows * config.tileOverlap);
+    Rect imageRect(0, 0, cols, rows);
+
+    tiles.clear();
+    for(int y = 0; y < numTiles; ++y) {
+        for(int x = 0; x < numTiles; ++x) {
+            int left = x * cols / numTiles - overlapX / 2;
+            int top = y * rows / numTiles - overlapY / 2;
+            int right = (x + 1) * cols / numTiles + overlapX / 2;
+            int bottom = (y + 1) * rows / numTiles + overlapY / 2;
+            tiles.push_back(Rect(left, top, right - left, bottom - top) & imageRect);
+        }
+    }
+    tileWorkspaces.resize(tiles.size());
+
+    // Nested parallel loops inside the detector run serially, so each tile uses one core
+    parallel_for_(Range(0, (int) tiles.size()), [&](const Range& range) {
+        for(int i = range.start; i < range.end; ++i) {
+            ScopedTraceEvent tileEvent(config.profiler, "tile", "tile", i);
+            detectInArea(frame.image, tiles[i], tileWorkspaces[i]);
+        }
+    });
+
+    frame.ids.clear();
+    frame.rejected.clear();
+    size_t numMarkers = 0;
+    for(const Workspace& workspace : tileWorkspaces) {
+        mergeMarkers(workspace, frame, numMarkers);
+    }
+    frame.corners.resize(numMarkers);
+}
+
+// Returns false if a marker found by the last full scan was not found in its region
+bool MarkerDetector::detectInRegions(FrameState& frame) {
+    ScopedTraceEvent event(config.profiler, "region scan");
+    ++numRegionScans;
+
+    findRegions(frame.image.size());
+    frame.ids.clear();
+    frame.rejected.clear();
+
+    size_t numMarkers = 0;
+    for(const Rect& region : regions) {
+        detectInArea(frame.image, region, regionWorkspace);
+        mergeMarkers(regionWorkspace, frame, numMarkers);
+    }
+    frame.corners.resize(numMarkers);
+
+    for(int id : expectedIDs) {
+        if(find(frame.ids.begin(), frame.ids.end(), id) == frame.ids.end())
+            return false;
+    }
+    return true;
+}
+
+// Pad the bounding box of each marker from the last frame and merge boxes that overlap
+void MarkerDetector::findRegions(Size imageSize) {
+    regions.clear();
+    Rect imageRect(0, 0, imageSize.width, imageSize.height);
+
+    for(const vector<Point2f>& corners : lastCorners) {
+        Rect box = boundingRect(corners);
+        int padding = max((int) (max(box.width, box.height) * config.regionPadding), minRegionPadding);
+        box.x -= padding;
+        box.y -= padding;
+        box.width += 2 * padding;
+        box.height += 2 * padding;
+
+        box &= imageRect;
+        if(box.area() > 0) {
+            regions.push_back(box);
+        }
+    }
+
+    // Markers in overlapping regions would be found twice, so merge them until none overlap
+    bool merged = true;
+    while(merged) {
+        merged = false;
+        for(size_t i = 0; i < regions.size() && !merged; ++i) {
+            for(size_t j = i + 1; j < regions.size(); ++j) {
+                if((regions[i] & regions[j]).area() > 0) {
+                    regions[i] |= regions[j];
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Search one area of an image, leaving markers in the workspace in image coordinates
+void MarkerDetector::detectInArea(const Mat& image, const Rect& area, Workspace& workspace) {
+    // Detector parameters may be changed between frames, so they are copied every time
+    // Perimeter rates are relative to the image size, so scale them to keep the same
+    // limits in pixels as a full-frame search
+    *workspace.params = *frameParams;
+    double scale = (double) max(image.cols, image.rows) / max(area.width, area.height);
+    workspace.params->minMarkerPerimeterRate = frameParams->minMarkerPerimeterRate * scale;
+    workspace.params->maxMarkerPerimeterRate = frameParams->maxMarkerPerimeterRate * scale;
+
+    detectInImage(image(area), workspace.params, workspace, workspace.corners, workspace.ids,
+                  workspace.rejected);
+
+    // Move corners from area coordinates to image coordinates
+    Point2f offset((float) area.x, (float) area.y);
+    for(vector<Point2f>& marker : workspace.corners) {
+        for(Point2f& corner : marker) {
+            corner += offset;
+        }
+    }
+    if(config.showRejected) {
+        for(vector<Point2f>& candidate : workspace.rejected) {
+            for(Point2f& corner : candidate) {
+                corner += offset;
+            }
+        }
+    }
+}
+
+// Add the markers and rejected candidates of a workspace to the frame, skipping markers
+// that were already found by an overlapping area
+void MarkerDetector::mergeMarkers(const Workspace& workspace, FrameState& frame, size_t& numMarkers) {
+    for(size_t i = 0; i < workspace.ids.size(); ++i) {
+        bool duplicate = false;
+        for(size_t j = 0; j < numMarkers && !duplicate; ++j) {
+            duplicate = frame.ids[j] == workspace.ids[i] &&
+                        isSameMarker(frame.corners[j], workspace.corners[i]);
+        }
+        if(duplicate)
+            continue;
+
+        frame.ids.push_back(workspace.ids[i]);
+        if(frame.corners.size() <= numMarkers) {
+            frame.corners.emplace_back();
+        }
+        frame.corners[numMarkers++].assign(workspace.corners[i].begin(), workspace.corners[i].end());
+    }
+
+    if(config.showRejected) {
+        frame.rejected.insert(frame.rejected.end(), workspace.rejected.begin(), workspace.rejected.end());
+    }
+}
+
+// Detect markers in an image, on a shrunk copy if the detection scale is above 1
+// Rejected candidates are only collected if they are shown
+void MarkerDetector::detectInImage(const Mat& image, const Ptr<aruco::DetectorParameters>& params,
+                                   Workspace& workspace, vector<vector<Point2f>>& corners,
+                                   vector<int>& ids, vector<vector<Point2f>>& rejected) {
+    // Rejected candidates are only drawn, so they are left empty unless they will be shown
+    vector<vector<Point2f>>* wantedRejected = config.showRejected ? &rejected : nullptr;
+    rejected.clear();
+
+    int scale = detectionScale;
+    if(scale <= 1) {
+        findMarkers(image, config, params, corners, ids, wantedRejected);
+        return;
+    }
+
+    {
+        ScopedTraceEvent event(config.profiler, "shrink");
+        // Regions and tiles can be smaller than the scale, so the shrunk image keeps at least a pixel
+        Size shrunkSize(max(image.cols / scale, 1), max(image.rows / scale, 1));
+        resize(image, workspace.scaledImage, shrunkSize, 0, 0, INTER_AREA);
+    }
+
+    // Pixel sizes shrink with the image, while perimeter rates are already relative to its size
+    // Corners are refined afterwards at full resolution, so they are not refined here
+    Ptr<aruco::DetectorParameters>& scaledParams = workspace.scaledParams;
+    *scaledParams = *params;
+    scaledParams->adaptiveThreshWinSizeMin = max(params->adaptiveThreshWinSizeMin / scale, 3);
+    scaledParams->adaptiveThreshWinSizeMax = max(params->adaptiveThreshWinSizeMax / scale,
+                                                 scaledParams->adaptiveThreshWinSizeMin);
+    scaledParams->adaptiveThreshWinSizeStep = max(params->adaptiveThreshWinSizeStep / scale, 1);
+    scaledParams->minDistanceToBorder = params->minDistanceToBorder / scale;
+    scaledParams->cornerRefinementMethod = aruco::CORNER_REFINE_NONE;
+
+    findMarkers(workspace.scaledImage, config, scaledParams, corners, ids, wantedRejected);
+
+    // Map pixel centers of the shrunk image back to the full-resolution image
+    // Each axis has its own factor, since a side clamped to one pixel is shrunk less than the other
+    float scaleX = (float) image.cols / workspace.scaledImage.cols;
+    float scaleY = (float) image.rows / workspace.scaledImage.rows;
+    for(vector<Point2f>& marker : corners) {
+        for(Point2f& corner : marker) {
+            corner = Point2f((corner.x + 0.5f) * scaleX - 0.5f, (corner.y + 0.5f) * scaleY - 0.5f);
+        }
+    }
+    for(vector<Point2f>& candidate : rejected) {
+        for(Point2f& corner : candidate) {
+            corner = Point2f((corner.x + 0.5f) * scaleX - 0.5f, (corner.y + 0.5f) * scaleY - 0.5f);
+        }
+    }
+
+    refineCorners(image, workspace, corners);
+}
+
+// Refine corners found in a shrunk image within small windows of the full-resolution image
+void MarkerDetector::refineCorners(const Mat& image, Workspace& workspace, vector<vector<Point2f>>& corners) {
+    ScopedTraceEvent event(config.profiler, "refine corners", "markers", corners.size());
+
+    // Mapped corners can be off by about one pixel of the shrunk image
+    int halfWindow = 2 * detectionScale;
+    Rect imageRect(0, 0, image.cols, image.rows);
+    TermCriteria criteria(TermCriteria::MAX_ITER | TermCriteria::EPS,
+                          frameParams->cornerRefinementMaxIterations,
+                          frameParams->cornerRefinementMinAccuracy);
+
+    for(vector<Point2f>& marker : corners) {
+        // Only the area around the marker is converted to grayscale
+        Rect window = boundingRect(marker);
+        window.x -= halfWindow + 1;
+        window.y -= halfWindow + 1;
+        window.width += 2 * (halfWindow + 1);
+        window.height += 2 * (halfWindow + 1);
+        window &= imageRect;
+        if(window.area() == 0)
+            continue;
+
+        if(image.channels() == 3) {
+            cvtColor(image(window), workspace.grayWindow, COLOR_BGR2GRAY);
+        }
+        else {
+            image(window).copyTo(workspace.grayWindow);
+        }
+
+        Point2f offset((float) window.x, (float) window.y);
+        for(Point2f& corner : marker) {
+            corner -= offset;
+        }
+        cornerSubPix(workspace.grayWindow, marker, Size(halfWindow, halfWindow), Size(-1, -1), criteria);
+        for(Point2f& corner : marker) {
+            corner += offset;
+        }
+    }
+}
@@ -0,0 +1,146 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * detection.h
+ * Contains a marker detector that keeps state between consecutive frames of one video,
+ * so it can search only around where markers were last seen or follow their corners with
+ * optical flow, search a shrunk copy of each frame before refining corners at full resolution,
+ * search tiles of large frames in parallel, skip frames that have not changed, and lower its
+ * own cost when a quality governor asks it to.
+ */
+
+#pragma once
+
+#include "tracking.h"
+#include <opencv2/core.hpp>
+#include <opencv2/aruco.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Detects markers in consecutive frames of one video
+// With region tracking enabled, only padded regions around the markers of the previous frame
+// are searched, and the whole frame is searched every few frames or when a marker goes missing
+// With optical flow enabled, marker corners are followed from the previous frame between searches
+// With base locking enabled, the base marker's pose is fixed once it has stayed still, and it is
+// only checked by comparing image patches around its corners until a full search sees it again
+// With the motion gate enabled, frames that barely differ from the last processed frame are not
+// searched, and get its markers and poses instead
+class MarkerDetector {
+public:
+    // Region tracking, optical flow, base locking, and the motion gate are only used if consecutiveFrames is set,
+    // for frames that are passed in order
+    explicit MarkerDetector(const TrackerConfig& config, bool consecutiveFrames = true);
+
+    // Detect markers in the frame image, frames must be passed in order if consecutiveFrames is set
+    void detect(FrameState& frame);
+
+    // Number of frames that were fully searched, searched only in regions, and followed with
+    // optical flow, safe to call from any thread
+    int64_t fullScans() const;
+    int64_t regionScans() const;
+    int64_t flowFrames() const;
+    // Number of unchanged frames given the results of the last processed frame
+    int64_t reusedFrames() const;
+    // Returns true while the base marker's pose is locked, safe to call from any thread
+    bool baseLocked() const;
+
+private:
+    // Detector parameters and scratch data for searching one part of a frame
+    struct Workspace {
+        Workspace();
+
+        cv::Ptr<cv::aruco::DetectorParameters> params;
+        cv::Ptr<cv::aruco::DetectorParameters> scaledParams;
+        cv::Mat scaledImage, grayWindow;
+        std::vector<int> ids;
+        std::vector<std::vector<cv::Point2f>> corners, rejected;
+    };
+
+    // Search for markers in the whole frame or in regions around their last positions
+    void search(FrameState& frame);
+    // Returns false if a marker could not be followed from the previous frame
+    bool followWithFlow(FrameState& frame);
+    // Lock the base marker once it has stayed still, check it against a full search while locked,
+    // and put its locked corners and pose into the frame
+    void updateBaseLock(FrameState& frame, bool fullScan);
+    void lockBase(const std::vector<cv::Point2f>& corners);
+    // Returns true if the image around each corner of the locked base marker has not changed
+    bool basePatchesMatch();
+    // Returns true if no pixel of the shrunk frame changed by the motion threshold or more
+    // since the last processed frame
+    bool isUnchanged(const FrameState& frame);
+    // Put the markers and poses of the last processed frame into the frame
+    void reuseLastResults(FrameState& frame);
+    // Copy the configured detector settings and lower their cost to the governor's quality level
+    void applyQuality();
+    void detectFullFrame(FrameState& frame);
+    // Search overlapping tiles of the frame in parallel and merge their markers
+    void detectInTiles(FrameState& frame);
+    // Returns false if a marker found by the last full scan was not found in its region
+    bool detectInRegions(FrameState& frame);
+    void findRegions(cv::Size imageSize);
+
+    // Search one area of an image, leaving markers in the workspace in image coordinates
+    void detectInArea(const cv::Mat& image, const cv::Rect& area, Workspace& workspace);
+    // Detect markers in an image, on a shrunk copy if the detection scale is above 1
+    // Rejected candidates are only collected if they are shown
+    void detectInImage(const cv::Mat& image, const cv::Ptr<cv::aruco::DetectorParameters>& params,
+                       Workspace& workspace, std::vector<std::vector<cv::Point2f>>& corners,
+                       std::vector<int>& ids, std::vector<std::vector<cv::Point2f>>& rejected);
+    // Refine corners found in a shrunk image within small windows of the full-resolution image
+    void refineCorners(const cv::Mat& image, Workspace& workspace,
+                       std::vector<std::vector<cv::Point2f>>& corners);
+    // Add the markers and rejected candidates of a workspace to the frame, skipping markers
+    // that were already found by an overlapping area
+    void mergeMarkers(const Workspace& workspace, FrameState& frame, size_t& numMarkers);
+
+    const TrackerConfig& config;
+    bool consecutiveFrames;
+
+    // Markers found in the last frame and IDs found by the last full scan
+    std::vector<int> lastIDs;
+    std::vector<std::vector<cv::Point2f>> lastCorners;
+    std::vector<int> expectedIDs;
+    int framesSinceFullScan = 0;
+    int framesSinceSearch = 0;
+    bool lastSearchWasFull = false;
+    bool forceFullScan = false;
+
+    // Base marker corners while it is still or locked, and its pose and corner patches once locked
+    std::atomic<bool> isBaseLocked;
+    int baseStillFrames = 0;
+    std::vector<cv::Point2f> baseCorners, baseCornerSum;
+    cv::Vec3d baseRvec, baseTvec;
+    std::vector<cv::Rect> basePatchRects;
+    std::vector<cv::Mat> basePatches;
+    cv::Mat patchScore;
+
+    // Shrunk grayscale images for the motion gate, and the results of the last processed frame
+    cv::Mat shrunkImage, motionImage, lastMotionImage;
+    std::vector<int> heldIDs;
+    std::vector<std::vector<cv::Point2f>> heldCorners;
+
+    // Grayscale images and corner positions for optical flow
+    cv::Mat gray, lastGray;
+    std::vector<cv::Point2f> flowPoints, nextPoints, backPoints;
+    std::vector<unsigned char> flowStatus, backStatus;
+    std::vector<float> flowError;
+
+    // Scratch data reused between frames
+    std::vector<cv::Rect> regions;
+    std::vector<cv::Rect> tiles;
+    Workspace frameWorkspace;
+    Workspace regionWorkspace;
+    std::vector<Workspace> tileWorkspaces;
+
+    std::atomic<int64_t> numFullScans;
+    std::atomic<int64_t> numRegionScans;
+    std::atomic<int64_t> numFlowFrames;
+    std::atomic<int64_t> numReusedFrames;
+
+    // Detector settings for the current frame, lowered to the governor's quality level
+    cv::Ptr<cv::aruco::DetectorParameters> frameParams;
+    int detectionScale = 1;
+};
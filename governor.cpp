@@ -0,0 +1,69 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * governor.cpp
+ * Contains the quality governor that keeps the tracker at a target frame rate.
+ */
+
+#include "governor.h"
+
+using namespace std;
+
+namespace {
+    // Weight of the newest frame time in the smoothed frame time
+    const double smoothing = 0.1;
+    // Quality is lowered above this fraction of the frame budget and raised below the lower one,
+    // the gap between them keeps the level from switching back and forth
+    const double upperLoad = 0.95;
+    const double lowerLoad = 0.6;
+    // Frames to wait after a change before lowering or raising the quality again, so the
+    // smoothed time can settle at the new level, raising waits longer since falling behind costs more
+    const int lowerWaitFrames = 15;
+    const int raiseWaitFrames = 90;
+
+    const char* levelNames[QUALITY_LEVEL_COUNT] = {"full", "one threshold", "no refinement", "shrunk",
+                                                   "sparse drawing"};
+}
+
+// Lowercase name of a quality level, used in statistics
+const char* qualityLevelName(int level) {
+    if(level < 0 || level >= QUALITY_LEVEL_COUNT)
+        return "unknown";
+    return levelNames[level];
+}
+
+QualityGovernor::QualityGovernor(double targetFps)
+    : budget(1.0 / targetFps), smoothedTime(0.0), currentLevel(QUALITY_FULL) {}
+
+// Record how long one frame took to process in seconds, and change the level if needed
+void QualityGovernor::addFrame(double seconds) {
+    double smoothed = smoothedTime;
+    smoothed = smoothed > 0 ? smoothed + smoothing * (seconds - smoothed) : seconds;
+    smoothedTime = smoothed;
+    ++framesSinceChange;
+
+    int level = currentLevel;
+    if(smoothed > upperLoad * budget && level < QUALITY_LEVEL_COUNT - 1 &&
+       framesSinceChange >= lowerWaitFrames) {
+        currentLevel = level + 1;
+        framesSinceChange = 0;
+    }
+    else if(smoothed < lowerLoad * budget && level > QUALITY_FULL && framesSinceChange >= raiseWaitFrames) {
+        currentLevel = level - 1;
+        framesSinceChange = 0;
+    }
+}
+
+int QualityGovernor::level() const {
+    return currentLevel;
+}
+
+double QualityGovernor::targetFps() const {
+    return 1.0 / budget;
+}
+
+// Smoothed time per frame in seconds
+double QualityGovernor::frameTime() const {
+    return smoothedTime;
+}
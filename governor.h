@@ -0,0 +1,48 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * governor.h
+ * Contains a quality governor that watches how long frames take to process and lowers
+ * the cost of detection and drawing when the tracker cannot keep up with a target frame rate.
+ */
+
+#pragma once
+
+#include <atomic>
+
+// Quality levels from the configured settings to the cheapest, each level also keeps
+// the reductions of the levels before it
+enum QualityLevel {
+    QUALITY_FULL = 0,
+    QUALITY_ONE_THRESHOLD,  // Only one adaptive threshold window size is tried
+    QUALITY_NO_REFINEMENT,  // Corners are not refined by the detector
+    QUALITY_SHRUNK,         // Detection scale is doubled
+    QUALITY_SPARSE_DRAWING, // The camera view is only drawn and shown for every other frame
+    QUALITY_LEVEL_COUNT
+};
+
+// Lowercase name of a quality level, used in statistics
+const char* qualityLevelName(int level);
+
+// Lowers the quality level when frames take longer than the time between frames at the
+// target rate, and raises it again when there is plenty of time to spare
+// Frame times are added from one thread, the level can be read from any thread
+class QualityGovernor {
+public:
+    explicit QualityGovernor(double targetFps);
+
+    // Record how long one frame took to process in seconds, and change the level if needed
+    void addFrame(double seconds);
+
+    int level() const;
+    double targetFps() const;
+    // Smoothed time per frame in seconds
+    double frameTime() const;
+
+private:
+    double budget;
+    int framesSinceChange = 0;
+    std::atomic<double> smoothedTime;
+    std::atomic<int> currentLevel;
+};
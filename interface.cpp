@@ -73,8 +73,9 @@ void getOptionsCLI(InputSettings& is, CommandLineParser& parser) {
     if(parser.has("v")) {
         is.inputFilename = parser.get<string>("v");
     }
-    else {
-        // Get collection rate if not collecting data from a video file
+
+    // Collection rate applies to camera input and to video file timestamps
+    if(parser.has("cr")) {
         is.collectionRate = parser.get<int>("cr");
     }
 
@@ -91,6 +92,37 @@ void getOptionsCLI(InputSettings& is, CommandLineParser& parser) {
     }
 
     is.numJoints = parser.get<int>("j");
+
+    if(parser.has("jg")) {
+        is.jointGraphFilename = parser.get<string>("jg");
+    }
+
+    is.bufferCapacity = parser.get<int>("bs");
+
+    if(parser.has("bp")) {
+        is.overflowPolicy = parser.get<int>("bp");
+    }
+
+    is.numWorkers = parser.get<int>("w");
+    is.numSegments = parser.get<int>("s");
+    is.showWindow = !parser.has("nd");
+    is.fullScanInterval = parser.get<int>("roi");
+    is.detectionScale = parser.get<int>("ds");
+    is.detectionTiles = parser.get<int>("tiles");
+    is.flowSearchInterval = parser.get<int>("flow");
+    is.baseLockFrames = parser.get<int>("base");
+    is.motionThreshold = parser.get<float>("motion");
+    is.warmStartPoses = parser.has("warm");
+    is.undistortGridSpacing = parser.get<int>("ucam");
+    is.governorFps = parser.get<double>("gov");
+
+    if(parser.has("prof")) {
+        is.profileFilename = parser.get<string>("prof");
+    }
+
+    if(parser.has("trace")) {
+        is.traceFilename = parser.get<string>("trace");
+    }
 }
 
 // Display an error message when a GLFW error occurs
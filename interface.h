@@ -7,6 +7,8 @@
  * function declarations, and an InputSettings structure definition.
  */
 
+#pragma once
+
 #include <opencv2/highgui.hpp>
 #include <string>
 
@@ -19,11 +21,28 @@ struct InputSettings {
     int cameraID = 0;
     int collectionRate = 0;
     int numJoints = 0;
+    int bufferCapacity = 4;
+    int overflowPolicy = -1; // Negative chooses a policy based on the input type
+    int numWorkers = 0;
+    int numSegments = 0;
+    bool showWindow = true;
+    int fullScanInterval = 0;
+    int detectionScale = 1;
+    int detectionTiles = 1;
+    int flowSearchInterval = 0;
+    int baseLockFrames = 0;
+    float motionThreshold = 0.0f;
+    bool warmStartPoses = false;
+    int undistortGridSpacing = 0;
+    double governorFps = 0.0;
     float markerLength = 0.0f;
     std::string calibFilename;
     std::string detectorFilename;
+    std::string jointGraphFilename;
     std::string inputFilename;
     std::string outputFilename;
+    std::string profileFilename;
+    std::string traceFilename;
 };
 
 // Check if a file with the passed filename exists
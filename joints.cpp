@@ -0,0 +1,94 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * joints.cpp
+ * Contains the joint graph and the joint graph file reader.
+ */
+
+#include "joints.h"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+using namespace cv;
+
+// Compile marker IDs and joints given as first, vertex, and last marker IDs into a joint graph
+// Returns false if an ID is negative or listed twice, or a joint does not use three listed markers
+bool buildJointGraph(const vector<int>& markerIDs, const vector<Vec3i>& joints, JointGraph& graph) {
+    int maxID = -1;
+    for(int id : markerIDs) {
+        if(id < 0)
+            return false;
+        maxID = max(maxID, id);
+    }
+
+    // Markers get slots in the order they are listed
+    JointGraph built;
+    built.markerIDs = markerIDs;
+    built.idSlots.assign((size_t) (maxID + 1), -1);
+    for(size_t slot = 0; slot < markerIDs.size(); ++slot) {
+        int& idSlot = built.idSlots[markerIDs[slot]];
+        if(idSlot >= 0)
+            return false;
+        idSlot = (int) slot;
+    }
+
+    for(const Vec3i& joint : joints) {
+        int first = built.slotOf(joint[0]);
+        int vertex = built.slotOf(joint[1]);
+        int last = built.slotOf(joint[2]);
+        if(first < 0 || vertex < 0 || last < 0 || first == vertex || vertex == last || first == last)
+            return false;
+
+        built.firstSlots.push_back(first);
+        built.vertexSlots.push_back(vertex);
+        built.lastSlots.push_back(last);
+    }
+
+    graph = move(built);
+    return true;
+}
+
+// Get the joint graph of a single chain, where marker IDs 0 to numJoints + 1 are tracked
+// and each joint is at the marker between the markers before and after it
+JointGraph makeChainGraph(int numJoints) {
+    vector<int> markerIDs;
+    vector<Vec3i> joints;
+    for(int i = 0; i < numJoints + 2; ++i) {
+        markerIDs.push_back(i);
+    }
+    for(int i = 0; i < numJoints; ++i) {
+        joints.push_back(Vec3i(i, i + 1, i + 2));
+    }
+
+    JointGraph graph;
+    buildJointGraph(markerIDs, joints, graph);
+    return graph;
+}
+
+// Read marker IDs and joints from a given file and compile them into a joint graph
+// Markers are listed under "markers" and each joint under "joints" as a sequence of
+// its first, vertex, and last marker IDs
+bool readJointGraph(string filename, JointGraph& graph) {
+    FileStorage fs(filename, FileStorage::READ);
+    if(!fs.isOpened())
+        return false;
+
+    vector<int> markerIDs;
+    fs["markers"] >> markerIDs;
+    if(markerIDs.empty())
+        return false;
+
+    vector<Vec3i> joints;
+    FileNode jointsNode = fs["joints"];
+    for(const FileNode& jointNode : jointsNode) {
+        vector<int> jointIDs;
+        jointNode >> jointIDs;
+        if(jointIDs.size() != 3)
+            return false;
+        joints.push_back(Vec3i(jointIDs[0], jointIDs[1], jointIDs[2]));
+    }
+
+    return buildJointGraph(markerIDs, joints, graph);
+}
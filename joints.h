@@ -0,0 +1,43 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * joints.h
+ * Contains the joint graph, which lists the tracked markers by ID and the three markers that
+ * make up each joint, so markers can have any IDs and joints can form branches or separate arms.
+ */
+
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <string>
+#include <vector>
+
+// Tracked markers and the joints between them, with marker IDs compiled into dense slot numbers
+// Per-frame marker data is stored by slot, so finding the slot of a detected ID costs the same
+// for any ID
+struct JointGraph {
+    // Slot of a marker ID, or -1 if the ID is not tracked
+    int slotOf(int id) const {
+        return id >= 0 && (size_t) id < idSlots.size() ? idSlots[id] : -1;
+    }
+    size_t numMarkers() const { return markerIDs.size(); }
+    size_t numJoints() const { return vertexSlots.size(); }
+    // Largest tracked marker ID, or -1 if no markers are tracked
+    int maxID() const { return (int) idSlots.size() - 1; }
+
+    std::vector<int> markerIDs; // Marker ID of each slot
+    std::vector<int> idSlots;   // Slot of each ID up to the largest tracked ID, -1 if not tracked
+    // Slots of the three markers of each joint, whose angle is measured at the vertex marker
+    std::vector<int> firstSlots, vertexSlots, lastSlots;
+};
+
+// Compile marker IDs and joints given as first, vertex, and last marker IDs into a joint graph
+// Returns false if an ID is negative or listed twice, or a joint does not use three listed markers
+bool buildJointGraph(const std::vector<int>& markerIDs, const std::vector<cv::Vec3i>& joints,
+                     JointGraph& graph);
+// Get the joint graph of a single chain, where marker IDs 0 to numJoints + 1 are tracked
+// and each joint is at the marker between the markers before and after it
+JointGraph makeChainGraph(int numJoints);
+// Read marker IDs and joints from a given file and compile them into a joint graph
+bool readJointGraph(std::string filename, JointGraph& graph);
@@ -0,0 +1,145 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * kinematics.cpp
+ * Contains the batched joint angle and marker rotation calculations.
+ * Library trig functions stop compilers from vectorizing a loop unless math is allowed to be
+ * inexact, so the loops use the polynomial approximations below, which only need arithmetic,
+ * square roots, and selects. Loops are marked with omp simd, which takes effect with
+ * -fopenmp-simd in GCC and Clang and /openmp:experimental in MSVC.
+ */
+
+#include "kinematics.h"
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+    const float pi = 3.14159265f;
+    const float degreesPerRadian = 180.0f / pi;
+
+    // Arctangent of y / x in radians, within 2e-7 of atan2f
+    // Zero for x and y of 0, like atan2f
+    inline float approxAtan2(float y, float x) {
+        float absX = fabsf(x);
+        float absY = fabsf(y);
+        float larger = absX > absY ? absX : absY;
+        float smaller = absX > absY ? absY : absX;
+
+        // Least squares fit of atan(t) / t in t^2 over 0 <= t <= 1 at Chebyshev nodes
+        float t = smaller / (larger > FLT_MIN ? larger : FLT_MIN);
+        float t2 = t * t;
+        float angle = t * (0.9999998977f + t2 * (-0.3333195924f + t2 * (0.1996922802f +
+                      t2 * (-0.1401654224f + t2 * (0.09905977723f + t2 * (-0.05936538870f +
+                      t2 * (0.02416496523f + t2 * -0.004668428397f)))))));
+
+        // Unfold the angle from the first half-quadrant into the right quadrant
+        angle = absY > absX ? pi / 2 - angle : angle;
+        angle = x < 0.0f ? pi - angle : angle;
+        return copysignf(angle, y);
+    }
+}
+
+// Angles in degrees between pairs of vectors a and b, calculated as atan2(|a x b|, a . b),
+// which stays accurate for nearly straight and nearly folded joints, unlike acos
+// Angles are within 0.001 degrees of the same calculation in double precision
+// Zero-length vectors give an angle of 0
+void computeVectorAngles(const float* ax, const float* ay, const float* az, const float* bx,
+                         const float* by, const float* bz, float* angles, size_t count) {
+    #pragma omp simd
+    for(size_t i = 0; i < count; ++i) {
+        float crossX = ay[i] * bz[i] - az[i] * by[i];
+        float crossY = az[i] * bx[i] - ax[i] * bz[i];
+        float crossZ = ax[i] * by[i] - ay[i] * bx[i];
+        float crossLength = sqrtf(crossX * crossX + crossY * crossY + crossZ * crossZ);
+        float dot = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i];
+
+        angles[i] = approxAtan2(crossLength, dot) * degreesPerRadian;
+    }
+}
+
+// Angles in degrees of joints between points, where joint i is the angle at point vertex[i]
+// between points first[i] and last[i]
+// Vectors to the neighboring points are written to the six scratch arrays of count floats
+void computeJointAngles(const float* x, const float* y, const float* z, const int* first,
+                        const int* vertex, const int* last, float* scratch[6], float* angles,
+                        size_t count) {
+    float* ax = scratch[0];
+    float* ay = scratch[1];
+    float* az = scratch[2];
+    float* bx = scratch[3];
+    float* by = scratch[4];
+    float* bz = scratch[5];
+
+    // Points are gathered once into contiguous vectors, so the angle loop reads them in order
+    #pragma omp simd
+    for(size_t i = 0; i < count; ++i) {
+        ax[i] = x[first[i]] - x[vertex[i]];
+        ay[i] = y[first[i]] - y[vertex[i]];
+        az[i] = z[first[i]] - z[vertex[i]];
+        bx[i] = x[last[i]] - x[vertex[i]];
+        by[i] = y[last[i]] - y[vertex[i]];
+        bz[i] = z[last[i]] - z[vertex[i]];
+    }
+
+    computeVectorAngles(ax, ay, az, bx, by, bz, angles, count);
+}
+
+// Converts rotation vectors to X-Y-Z Tait-Bryan angles in degrees, with the singularities at the
+// poles handled as in the euclideanspace.com matrix to Euler angle conversion
+// Angles are within 0.001 degrees of Rodrigues followed by that conversion in double precision,
+// except right at the pole threshold, where either side of the jump can be taken
+void rotationVectorsToEuler(const float* rx, const float* ry, const float* rz, float* bank,
+                            float* heading, float* attitude, size_t count) {
+    #pragma omp simd
+    for(size_t i = 0; i < count; ++i) {
+        float theta = sqrtf(rx[i] * rx[i] + ry[i] * ry[i] + rz[i] * rz[i]);
+
+        // Turning by a whole number of turns more or less is the same rotation, so the half
+        // angle is brought into [-pi / 2, pi / 2], where the series below are accurate
+        float turns = (float) (int) (theta * (0.5f / pi) + 0.5f);
+        float reduced = theta - 2.0f * pi * turns;
+        float half = 0.5f * reduced;
+        float h2 = half * half;
+
+        // Taylor series of sin(h) / h and cos(h), which need no special case for small angles
+        float sinc = 1.0f + h2 * (-1.0f / 6 + h2 * (1.0f / 120 + h2 * (-1.0f / 5040 +
+                     h2 * (1.0f / 362880 + h2 * (-1.0f / 39916800)))));
+        float cosHalf = 1.0f + h2 * (-1.0f / 2 + h2 * (1.0f / 24 + h2 * (-1.0f / 720 +
+                        h2 * (1.0f / 40320 + h2 * (-1.0f / 3628800 + h2 * (1.0f / 479001600))))));
+
+        // Unit quaternion of the rotation, sin(h) / theta scales the rotation vector to its axis
+        float axisScale = sinc * half / (theta > FLT_MIN ? theta : FLT_MIN);
+        float qx = rx[i] * axisScale;
+        float qy = ry[i] * axisScale;
+        float qz = rz[i] * axisScale;
+        float qw = cosHalf;
+
+        // Rotation matrix elements used by the Euler angle conversion
+        // https://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToEuler/index.htm
+        float m00 = 1.0f - 2.0f * (qy * qy + qz * qz);
+        float m02 = 2.0f * (qx * qz + qw * qy);
+        float m10 = 2.0f * (qx * qy + qw * qz);
+        float m11 = 1.0f - 2.0f * (qx * qx + qz * qz);
+        float m12 = 2.0f * (qy * qz - qw * qx);
+        float m20 = 2.0f * (qx * qz - qw * qy);
+        float m22 = 1.0f - 2.0f * (qx * qx + qy * qy);
+
+        // Near the poles, the heading takes up all of the rotation about the vertical axis
+        // Both cases are calculated for every marker and the right one is selected
+        bool pole = fabsf(m10) > 0.998f;
+        float cosAttitude2 = 1.0f - m10 * m10;
+        float cosAttitude = sqrtf(cosAttitude2 > 0.0f ? cosAttitude2 : 0.0f);
+        float bankRadians = approxAtan2(-m12, m11);
+        float attitudeRadians = approxAtan2(m10, cosAttitude);
+        float headingRadians = approxAtan2(pole ? m02 : -m20, pole ? m22 : m00);
+        bankRadians = pole ? 0.0f : bankRadians;
+        attitudeRadians = pole ? copysignf(pi / 2, m10) : attitudeRadians;
+
+        bank[i] = bankRadians * degreesPerRadian;
+        heading[i] = headingRadians * degreesPerRadian;
+        attitude[i] = attitudeRadians * degreesPerRadian;
+    }
+}
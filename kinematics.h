@@ -0,0 +1,35 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * kinematics.h
+ * Contains batched joint angle and marker rotation calculations. Inputs and outputs are
+ * stored as one contiguous array per coordinate, so each loop runs the same arithmetic over
+ * many joints or markers and can be vectorized by the compiler. Any number of values can be
+ * passed at once, such as the joints of one frame or of many frames.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// Angles in degrees between pairs of vectors a and b, calculated as atan2(|a x b|, a . b),
+// which stays accurate for nearly straight and nearly folded joints, unlike acos
+// Angles are within 0.001 degrees of the same calculation in double precision
+// Zero-length vectors give an angle of 0
+void computeVectorAngles(const float* ax, const float* ay, const float* az, const float* bx,
+                         const float* by, const float* bz, float* angles, size_t count);
+
+// Angles in degrees of joints between points, where joint i is the angle at point vertex[i]
+// between points first[i] and last[i]
+// Vectors to the neighboring points are written to the six scratch arrays of count floats
+void computeJointAngles(const float* x, const float* y, const float* z, const int* first,
+                        const int* vertex, const int* last, float* scratch[6], float* angles,
+                        size_t count);
+
+// Converts rotation vectors to X-Y-Z Tait-Bryan angles in degrees, with the singularities at the
+// poles handled as in the euclideanspace.com matrix to Euler angle conversion
+// Angles are within 0.001 degrees of Rodrigues followed by that conversion in double precision,
+// except right at the pole threshold, where either side of the jump can be taken
+void rotationVectorsToEuler(const float* rx, const float* ry, const float* rz, float* bank,
+                            float* heading, float* attitude, size_t count);
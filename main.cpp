@@ -3,18 +3,22 @@
  * ArUco Marker Joint Tracker
  * 
  * main.cpp
- * Gets inputs settings and runs data collection.
+ * Gets inputs settings and runs data collection through the tracking pipeline.
  * 
  * ArUco marker detection code obtained from: https://github.com/opencv/opencv_contrib/blob/master/modules/aruco/samples/detect_markers.cpp
  */
 
+#include "alloc_counter.h"
 #include "interface.h"
+#include "offline.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "tracking.h"
 #include <opencv2/highgui.hpp>
 #include <opencv2/aruco.hpp>
-#include <opencv2/imgproc.hpp>
-#include <opencv2/calib3d.hpp>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 using namespace std;
 using namespace cv;
@@ -37,98 +41,77 @@ namespace {
         "{refine   |       | Corner refinement: CORNER_REFINE_NONE=0, CORNER_REFINE_SUBPIX=1,"
         "CORNER_REFINE_CONTOUR=2, CORNER_REFINE_APRILTAG=3}"
         "{o        |       | Joint angle output filename, if none, filename is automatically indexed }"
-        "{cr       |       | Number of times per second to collect joint angle data }"
-        "{j        | 1     | Number of joints to collect angle data for }";
-}
-
-// Function from OpenCV library
-// Converts a given Rotation Matrix to Euler angles
-// Convention used is X-Y-Z Tait-Bryan angles
-// Reference code implementation:
-// https://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToEuler/index.htm
-Vec3f rot2euler(const cv::Mat& rotationMatrix) {
-    Vec3f euler;
-
-    double m00 = rotationMatrix.at<double>(0, 0);
-    double m02 = rotationMatrix.at<double>(0, 2);
-    double m10 = rotationMatrix.at<double>(1, 0);
-    double m11 = rotationMatrix.at<double>(1, 1);
-    double m12 = rotationMatrix.at<double>(1, 2);
-    double m20 = rotationMatrix.at<double>(2, 0);
-    double m22 = rotationMatrix.at<double>(2, 2);
-
-    double bank, attitude, heading;
-
-    // Assuming the angles are in radians.
-    if(m10 > 0.998) { // singularity at north pole
-        bank = 0;
-        attitude = CV_PI / 2;
-        heading = atan2(m02, m22);
-    }
-    else if(m10 < -0.998) { // singularity at south pole
-        bank = 0;
-        attitude = -CV_PI / 2;
-        heading = atan2(m02, m22);
-    }
-    else {
-        bank = atan2(-m12, m11);
-        attitude = asin(m10);
-        heading = atan2(-m20, m00);
-    }
-
-    euler[0] = bank * 180.0f / (float) CV_PI;
-    euler[1] = heading * 180.0f / (float) CV_PI;
-    euler[2] = attitude * 180.0f / (float) CV_PI;
-
-    return euler;
-}
-
-// Get the angle between two vectors using three passed points
-float getJointAngle(vector<Vec3f>& jointPoints, size_t startIndex) {
-    // The second point is the vertex of the angle
-    Vec3f v1 = jointPoints.at(startIndex) - jointPoints.at(startIndex + 1);
-    Vec3f v2 = jointPoints.at(startIndex + 2) - jointPoints.at(startIndex + 1);
-    float angle = acosf(v1.dot(v2) / (norm(v1) * norm(v2))) * 180.0f / (float) CV_PI;
-
-    return angle;
-}
+        "{cr       |       | Number of times per second to collect joint angle data, for video files (-v) "
+        "this uses video time and frames between collections are not decoded }"
+        "{j        | 1     | Number of joints to collect angle data for }"
+        "{jg       |       | Joint graph file listing the tracked marker IDs and the first, vertex, and last "
+        "marker of each joint, replaces the chain of joints set by -j }"
+        "{bs       | 4     | Capacity of the captured frame buffer }"
+        "{bp       |       | Frame buffer overflow policy: DROP_OLDEST=0, BLOCK=1. "
+        "Default is DROP_OLDEST for cameras and BLOCK for video files }"
+        "{w        | 0     | Number of worker threads processing video file (-v) frames in parallel, "
+        "if 0, the staged pipeline is used }"
+        "{s        | 0     | Number of video file (-v) segments decoded and processed in parallel "
+        "without a camera view window, if 0, the video is decoded by a single thread }"
+        "{nd       |       | Do not display the camera view window }"
+        "{roi      | 0     | Search for markers only around their last positions, with a full-frame search "
+        "every N frames or when a marker is lost, if 0, every frame is fully searched. "
+        "Not used with worker threads (-w) }"
+        "{ds       | 1     | Search for markers in a copy of each frame shrunk by this factor, "
+        "then refine their corners at full resolution }"
+        "{tiles    | 1     | Split full-frame marker searches into N by N overlapping tiles "
+        "that are searched in parallel }"
+        "{flow     | 0     | Search for markers every N frames and follow their corners with optical flow "
+        "in between, searching again when a corner is lost, if 0, every frame is searched. "
+        "Not used with worker threads (-w) }"
+        "{base     | 0     | Lock the pose of the base marker (ID 0) once it has stayed still for N frames, "
+        "until it moves, if 0, its pose is estimated every frame. Not used with worker threads (-w) }"
+        "{motion   | 0     | Reuse the markers and poses of the last processed frame for frames whose shrunk "
+        "image differs from it by less than this many gray levels at every pixel, if 0, every frame "
+        "is processed. Not used with worker threads (-w) }"
+        "{warm     |       | Refine the pose of each marker seen in the last frame from its last pose, "
+        "solving it from scratch only if the refined pose does not fit. Not used with worker threads (-w) }"
+        "{ucam     | 0     | Undistort marker corners by looking them up in a grid with points every N pixels "
+        "and solve poses in normalized coordinates, if 0, the full distortion model is used }"
+        "{gov      | 0     | Lower detection and drawing quality when frames take longer than this frame rate "
+        "allows and raise it again when there is time to spare, if -1, the input's frame rate is used, "
+        "if 0, quality is never changed }"
+        "{prof     |       | Stage latency report filename, written as JSON if it ends in .json and as CSV "
+        "otherwise, updated every 10 seconds and at exit }"
+        "{trace    |       | Timeline filename, written at exit in the Chrome trace event JSON format "
+        "for chrome://tracing or Perfetto }";
+
+    // Seconds between stage latency report updates
+    const double profileReportInterval = 10.0;
+    // Frame rate the quality governor aims for if the input does not report one
+    const double defaultGovernorFps = 30.0;
+    // Largest error in pixels of the undistortion grid, above which the full distortion model is used
+    const double maxUndistortionError = 0.05;
+
+    // Write the final stage latency report and trace, and print the latency summary
+    void finishProfile(Profiler* profiler, const InputSettings& is) {
+        if(profiler == nullptr)
+            return;
+
+        if(!profiler->writeReport()) {
+            cerr << "File \"" << is.profileFilename << "\" failed to open" << endl;
+        }
+        profiler->printSummary(cout);
 
-// Read camera parameters from a given file and store them in passed variables
-static bool readCameraParameters(string filename, Mat& camMatrix, Mat& distCoeffs) {
-    FileStorage fs(filename, FileStorage::READ);
-    if(!fs.isOpened())
-        return false;
-    fs["camera_matrix"] >> camMatrix;
-    fs["distortion_coefficients"] >> distCoeffs;
-    return true;
-}
+        TraceRecorder* trace = profiler->trace();
+        if(trace != nullptr) {
+            if(trace->writeJSON(is.traceFilename)) {
+                cout << "Trace written to \"" << is.traceFilename << "\"" << endl;
+            }
+            else {
+                cerr << "File \"" << is.traceFilename << "\" failed to open" << endl;
+            }
 
-// Read detector parameters from a given file and store them in passed variables
-static bool readDetectorParameters(string filename, Ptr<aruco::DetectorParameters>& params) {
-    FileStorage fs(filename, FileStorage::READ);
-    if(!fs.isOpened())
-        return false;
-    fs["adaptiveThreshWinSizeMin"] >> params->adaptiveThreshWinSizeMin;
-    fs["adaptiveThreshWinSizeMax"] >> params->adaptiveThreshWinSizeMax;
-    fs["adaptiveThreshWinSizeStep"] >> params->adaptiveThreshWinSizeStep;
-    fs["adaptiveThreshConstant"] >> params->adaptiveThreshConstant;
-    fs["minMarkerPerimeterRate"] >> params->minMarkerPerimeterRate;
-    fs["maxMarkerPerimeterRate"] >> params->maxMarkerPerimeterRate;
-    fs["polygonalApproxAccuracyRate"] >> params->polygonalApproxAccuracyRate;
-    fs["minCornerDistanceRate"] >> params->minCornerDistanceRate;
-    fs["minDistanceToBorder"] >> params->minDistanceToBorder;
-    fs["minMarkerDistanceRate"] >> params->minMarkerDistanceRate;
-    fs["cornerRefinementMethod"] >> params->cornerRefinementMethod;
-    fs["cornerRefinementWinSize"] >> params->cornerRefinementWinSize;
-    fs["cornerRefinementMaxIterations"] >> params->cornerRefinementMaxIterations;
-    fs["cornerRefinementMinAccuracy"] >> params->cornerRefinementMinAccuracy;
-    fs["markerBorderBits"] >> params->markerBorderBits;
-    fs["perspectiveRemovePixelPerCell"] >> params->perspectiveRemovePixelPerCell;
-    fs["perspectiveRemoveIgnoredMarginPerCell"] >> params->perspectiveRemoveIgnoredMarginPerCell;
-    fs["maxErroneousBitsInBorderRate"] >> params->maxErroneousBitsInBorderRate;
-    fs["minOtsuStdDev"] >> params->minOtsuStdDev;
-    fs["errorCorrectionRate"] >> params->errorCorrectionRate;
-    return true;
+            if(trace->droppedEvents() > 0) {
+                cout << "Dropped " << trace->droppedEvents() << " trace events after the buffers filled" << endl;
+            }
+        }
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -173,6 +156,16 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // Track a single chain of joints unless a joint graph file is given
+    JointGraph jointGraph = makeChainGraph(is.numJoints);
+    if(is.jointGraphFilename != "") {
+        bool readOk = readJointGraph(is.jointGraphFilename, jointGraph);
+        if(!readOk) {
+            cerr << "Invalid joint graph file" << endl;
+            return 1;
+        }
+    }
+
     if(is.hasRefinement) {
         // Override cornerRefinementMethod read from config file
         detectorParams->cornerRefinementMethod = is.cornerRefinement;
@@ -180,13 +173,19 @@ int main(int argc, char* argv[]) {
     cout << "Corner refinement method (0: None, 1: Subpixel, 2:contour, 3: AprilTag 2): " << detectorParams->cornerRefinementMethod << endl;
 
     // Time between joint angle data collection
-    double collectionTime = 0; // Collect data as fast as possible for pre-recorded video
+    double collectionTime = 0; // Collect data as fast as possible if there is no collection rate
 
-    // Check if there is a collection rate and using real-time video
-    if(is.collectionRate != 0 && is.inputFilename == "") {
+    // Check if there is a collection rate
+    if(is.collectionRate > 0) {
         collectionTime = 1.0f / is.collectionRate;
     }
 
+    // Video file frames between collection points are skipped before they are decoded,
+    // so the sink only needs to select frames to write for camera input
+    bool fromFile = (is.inputFilename != "");
+    double captureCollectionTime = fromFile ? collectionTime : 0;
+    double sinkCollectionTime = fromFile ? 0 : collectionTime;
+
     if(fileExists(is.outputFilename)) {
         cerr << "File " << is.outputFilename << " already exists" << endl;
         return 1;
@@ -198,8 +197,84 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if(is.collectionRate < 0) {
+        cerr << "Data collection rate cannot be negative" << endl;
+        return 1;
+    }
+    if(is.bufferCapacity < 1) {
+        cerr << "Frame buffer capacity must be positive" << endl;
+        return 1;
+    }
+    if(is.overflowPolicy > OVERFLOW_BLOCK) {
+        cerr << "Invalid frame buffer overflow policy" << endl;
+        return 1;
+    }
+    if(is.numWorkers < 0) {
+        cerr << "Number of worker threads cannot be negative" << endl;
+        return 1;
+    }
+    if(is.numSegments < 0) {
+        cerr << "Number of video segments cannot be negative" << endl;
+        return 1;
+    }
+    if(is.fullScanInterval < 0) {
+        cerr << "Full-frame search interval cannot be negative" << endl;
+        return 1;
+    }
+    if(is.detectionScale < 1) {
+        cerr << "Detection scale must be at least 1" << endl;
+        return 1;
+    }
+    if(is.detectionTiles < 1) {
+        cerr << "Number of detection tiles must be at least 1" << endl;
+        return 1;
+    }
+    if(is.flowSearchInterval < 0) {
+        cerr << "Optical flow search interval cannot be negative" << endl;
+        return 1;
+    }
+    if(is.baseLockFrames < 0) {
+        cerr << "Base marker lock frames cannot be negative" << endl;
+        return 1;
+    }
+    if(is.motionThreshold < 0) {
+        cerr << "Motion threshold cannot be negative" << endl;
+        return 1;
+    }
+    if(is.governorFps < 0 && is.governorFps != -1) {
+        cerr << "Quality governor frame rate must be positive, -1, or 0" << endl;
+        return 1;
+    }
+    // Worker threads and segments only split up video files, and would be ignored for a camera
+    if(!fromFile && (is.numWorkers > 0 || is.numSegments > 0)) {
+        cerr << "Worker threads (-w) and video segments (-s) can only be used with a video file (-v)"
+             << endl;
+        return 1;
+    }
+    // The governor only runs in the staged pipeline, which worker threads and segments replace
+    if(is.governorFps != 0 && (is.numWorkers > 0 || is.numSegments > 0)) {
+        cerr << "The quality governor (-gov) cannot be used with worker threads (-w) or video segments (-s)"
+             << endl;
+        return 1;
+    }
+    if(is.undistortGridSpacing < 0) {
+        cerr << "Undistortion grid spacing cannot be negative" << endl;
+        return 1;
+    }
+    if(is.numWorkers > 0 && is.numSegments > 0) {
+        cerr << "Worker threads (-w) and video segments (-s) cannot be combined" << endl;
+        return 1;
+    }
+
     Ptr<aruco::Dictionary> dictionary =
         aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(is.dictionary));
+    if(jointGraph.maxID() >= dictionary->bytesList.rows) {
+        cerr << "Joint graph marker IDs must be less than the dictionary size of "
+             << dictionary->bytesList.rows << endl;
+        return 1;
+    }
+    // Only the tracked IDs are searched for, so other markers are never detected or posed
+    dictionary = restrictDictionary(dictionary, jointGraph.markerIDs);
 
     // Read camera calibration file
     Mat camMatrix, distCoeffs;
@@ -223,181 +298,162 @@ int main(int argc, char* argv[]) {
     }
 
     // Print column titles to data output file
-    outputFile << "Total Time";
-    for(int i = 1; i <= is.numJoints; ++i) {
-        outputFile << ",Joint " << i << " Angle";
-    }
-    for(int i = 0; i < is.numJoints + 2; ++i) {
-        outputFile << ",Marker " << i << " Rotation";
-    }
-    outputFile << endl;
+    writeOutputHeader(outputFile, jointGraph);
 
     // Get video input from either a file or a camera
+    // Segments open a decoder each, so segment mode does not open one here
+    bool segmentMode = fromFile && is.numSegments > 0;
     VideoCapture inputVideo;
-    if(is.inputFilename != "") {
+    if(!fromFile) {
+        inputVideo.open(is.cameraID);
+    }
+    else if(!segmentMode) {
         inputVideo.open(is.inputFilename);
     }
-    else {
-        inputVideo.open(is.cameraID);
+
+    // Frame size of the input, read in segment mode from a decoder that is closed right away
+    Size inputSize;
+    {
+        VideoCapture probe;
+        if(segmentMode) {
+            probe.open(is.inputFilename);
+        }
+        const VideoCapture& sizeSource = segmentMode ? probe : inputVideo;
+        inputSize = Size((int) sizeSource.get(CAP_PROP_FRAME_WIDTH),
+                         (int) sizeSource.get(CAP_PROP_FRAME_HEIGHT));
     }
 
-    double totalDetectionTime = 0;
-    int totalIterations = 0;
+    // Frames shrunk by more than their smaller side would have no pixels left to search
+    int smallerSide = min(inputSize.width, inputSize.height);
+    if(smallerSide > 0 && is.detectionScale > smallerSide) {
+        cerr << "Detection scale cannot be larger than the input frame's smaller side of "
+             << smallerSide << " pixels" << endl;
+        return 1;
+    }
 
-    double prevCollectionTime = 0;
-    double startTime = (double) getTickCount();
-    
-    while(inputVideo.grab()) {
-        Mat image, imageCopy;
-        inputVideo.retrieve(image);
-
-        double tick = (double) getTickCount();
-
-        vector<int> ids;
-        vector<vector<Point2f>> corners, rejected;
-        vector<Vec3d> rvecs, tvecs;
-
-        // Detect markers and estimate pose
-        aruco::detectMarkers(image, dictionary, corners, ids, detectorParams, rejected);
-        if(estimatePose && ids.size() > 0)
-            aruco::estimatePoseSingleMarkers(corners, is.markerLength, camMatrix, distCoeffs, rvecs,
-                                             tvecs);
-
-        double currentTime = ((double) getTickCount() - tick) / getTickFrequency();
-        totalDetectionTime += currentTime;
-        ++totalIterations;
-
-        // Output detection time info every 30 loop iterations
-        if(totalIterations % 30 == 0) {
-            cout << "Detection Time = " << currentTime * 1000 << " ms "
-                 << "(Mean = " << 1000 * totalDetectionTime / double(totalIterations)
-                 << " ms)" << endl;
+    // Drop stale camera frames when processing falls behind, but never skip video file frames
+    OverflowPolicy overflowPolicy = fromFile ? OVERFLOW_BLOCK : OVERFLOW_DROP_OLDEST;
+    if(is.overflowPolicy >= 0) {
+        overflowPolicy = (OverflowPolicy) is.overflowPolicy;
+    }
+
+    TrackerConfig config;
+    config.dictionary = dictionary;
+    config.dictionaryIDs = jointGraph.markerIDs;
+    config.detectorParams = detectorParams;
+    config.camMatrix = camMatrix;
+    config.distCoeffs = distCoeffs;
+    config.markerLength = is.markerLength;
+    config.jointGraph = jointGraph;
+    config.estimatePose = estimatePose;
+    config.showRejected = is.showRejected;
+    config.fullScanInterval = is.fullScanInterval;
+    config.detectionScale = is.detectionScale;
+    config.detectionTiles = is.detectionTiles;
+    config.flowSearchInterval = is.flowSearchInterval;
+    config.baseLockFrames = is.baseLockFrames;
+    config.motionThreshold = is.motionThreshold;
+    config.warmStartPoses = is.warmStartPoses;
+
+    // The grid covers the input's frames, and is only used if it matches the full model closely
+    unique_ptr<CameraModel> cameraModel;
+    if(estimatePose && is.undistortGridSpacing > 0) {
+        if(inputSize.area() == 0) {
+            cerr << "Input frame size is unknown, so no undistortion grid can be built" << endl;
+            return 1;
         }
 
-        vector<float> jointAngles((size_t) is.numJoints);
-        vector<bool> anglesDetected((size_t) is.numJoints);
-        vector<bool> pointsDetected((size_t) is.numJoints + 2);
-        vector<Vec3f> markerAngles((size_t) is.numJoints + 2);
-
-        // draw results
-        image.copyTo(imageCopy);
-        if(ids.size() > 0) {
-            aruco::drawDetectedMarkers(imageCopy, corners, ids);
-
-            if(estimatePose) {
-                vector<Vec3f> jointPoints((size_t) is.numJoints + 2);
-                vector<Point2f> jointImagePoints((size_t) is.numJoints + 2);
-                int numIDs = ids.size();
-
-                for(int i = 0; i < numIDs; ++i) {
-                    float length = is.markerLength * 0.5f;
-
-                    aruco::drawAxis(imageCopy, camMatrix, distCoeffs, rvecs[i], tvecs[i], length);
-
-                    // Get marker 2D image points (code from OpenCV drawFrameAxes function)
-                    vector<Point3f> axesPoints;
-                    axesPoints.push_back(Point3f(0, 0, 0));
-                    axesPoints.push_back(Point3f(length, 0, 0));
-                    axesPoints.push_back(Point3f(0, length, 0));
-                    axesPoints.push_back(Point3f(0, 0, length));
-                    vector<Point2f> imagePoints;
-                    projectPoints(axesPoints, rvecs[i], tvecs[i], camMatrix, distCoeffs, imagePoints);
-
-                    int curID = ids[i];
-
-                    // Collect marker data if its ID is in the correct range
-                    if(curID < is.numJoints + 2) {
-                        jointPoints[curID] = tvecs[i];
-                        jointImagePoints[curID] = imagePoints[0];
-                        pointsDetected[curID] = true;
-
-                        Mat rotationMatrix;
-                        Rodrigues(rvecs[i], rotationMatrix);
-                        markerAngles[curID] = rot2euler(rotationMatrix);
-                    }
-                }
-
-                // Draw each joint angle
-                for(size_t i = 0; i < is.numJoints; ++i) {
-                    // Check that the points needed for the current angle are detected
-                    anglesDetected[i] = (pointsDetected[i] && pointsDetected[i + 1] && pointsDetected[i + 2]);
-
-                    if(anglesDetected[i]) {
-                        jointAngles[i] = getJointAngle(jointPoints, i);
-
-                        // Draw joint angle lines
-                        if(i == 0 || !anglesDetected[i - 1]) {
-                            // Draw first line if it has not been drawn for a previous angle
-                            line(imageCopy, jointImagePoints[i + 1], jointImagePoints[i], Scalar(0, 0, 0), 2);
-                        }
-                        line(imageCopy, jointImagePoints[i + 1], jointImagePoints[i + 2], Scalar(0, 0, 0), 2);
-
-                        // Get each line of the joint angle
-                        Vec2f v1 = jointImagePoints[i] - jointImagePoints[i + 1];
-                        Vec2f v2 = jointImagePoints[i + 2] - jointImagePoints[i + 1];
-
-                        // Get point in the middle of the angle
-                        Vec2f bisection = (normalize(v1) + normalize(v2)) * 25.0f;
-                        Point2f p;
-                        p.x = bisection[0] + jointImagePoints[i + 1].x;
-                        p.y = bisection[1] + jointImagePoints[i + 1].y;
-
-                        // Get rounded angle value as a string
-                        string displayText = to_string((int) round(jointAngles[i]));
-
-                        // Center angle text
-                        int baseline = 0;
-                        Size textSize = getTextSize(displayText, 0, 0.5, 2, &baseline);
-                        p.x -= textSize.width / 2.0f;
-                        p.y -= textSize.height / 2.0f;
-
-                        // Display angle text centered in the angle
-                        putText(imageCopy, displayText, p, 0, 0.5, Scalar(255, 255, 255), 2);
-                    }
-                }
+        cameraModel.reset(new CameraModel(camMatrix, distCoeffs, inputSize, is.undistortGridSpacing));
+        if(cameraModel->maxError() <= maxUndistortionError) {
+            cout << "Undistortion grid error is at most " << cameraModel->maxError() << " pixels" << endl;
+            config.cameraModel = cameraModel.get();
+        }
+        else {
+            cerr << "Undistortion grid error of " << cameraModel->maxError() << " pixels is above "
+                 << maxUndistortionError << ", using the full distortion model" << endl;
+        }
+    }
+
+    // Lower quality when processing cannot keep up with the target frame rate
+    unique_ptr<QualityGovernor> governor;
+    if(is.governorFps != 0) {
+        double targetFps = is.governorFps;
+        if(targetFps < 0) {
+            targetFps = inputVideo.get(CAP_PROP_FPS);
+            if(targetFps <= 0) {
+                targetFps = defaultGovernorFps;
             }
         }
+        governor.reset(new QualityGovernor(targetFps));
+        config.governor = governor.get();
+    }
 
-        currentTime = ((double) getTickCount() - startTime) / getTickFrequency();
+    // Only time stages if a latency report or trace was requested
+    unique_ptr<Profiler> profiler;
+    unique_ptr<TraceRecorder> trace;
+    if(is.profileFilename != "" || is.traceFilename != "") {
+        profiler.reset(new Profiler(is.profileFilename, profileReportInterval));
+        config.profiler = profiler.get();
+    }
+    if(is.traceFilename != "") {
+        trace.reset(new TraceRecorder());
+        profiler->setTrace(trace.get());
+        profiler->nameThread("Main");
+    }
 
-        // Write data to file if enough time has passed or first iteration
-        if(currentTime - prevCollectionTime >= collectionTime || totalIterations == 1) {
-            // Write program run time
-            outputFile << currentTime;
+    if(segmentMode) {
+        // Split the video into segments, each with its own decoder and sink
+        bool processOk = runSegmentParallel(config, is.inputFilename, outputFile, captureCollectionTime,
+                                            is.numSegments);
+        finishProfile(profiler.get(), is);
+        return processOk ? 0 : 1;
+    }
 
-            // Write joint angle data
-            for(int i = 0; i < is.numJoints; ++i) {
-                outputFile << ",";
-                if(anglesDetected[i]) {
-                    outputFile << jointAngles[i];
-                }
-            }
+    FrameSink sink(config, outputFile, sinkCollectionTime, is.showWindow);
 
-            // Write marker rotation data
-            for(int i = 0; i < is.numJoints + 2; ++i) {
-                outputFile << ",";
-                if(pointsDetected[i]) {
-                    outputFile << "\"" << markerAngles[i][0] << "," << markerAngles[i][1]
-                               << "," << markerAngles[i][2] << "\"";
-                }
-            }
+    if(is.inputFilename != "" && is.numWorkers > 0) {
+        // Recorded frames are independent, so process them out of order on worker threads
+        runFrameParallel(config, inputVideo, sink, is.numWorkers, captureCollectionTime);
+        finishProfile(profiler.get(), is);
+        return 0;
+    }
 
-            outputFile << endl;
+    // Capture, detection, pose estimation, and joint angle calculation run on their own threads
+    // Video file frames are timed by their timestamps instead of when they were processed
+    Pipeline pipeline(config, inputVideo, (size_t) is.bufferCapacity, overflowPolicy, fromFile,
+                      captureCollectionTime);
+    pipeline.start();
+
+    // Draw, write, and display each processed frame on this thread
+    while(FramePtr frame = pipeline.next()) {
+        // Waiting for the next frame is not sink work, so timing starts once it arrives
+        int64_t tick = getTickCount();
+        int64_t allocations = threadAllocationCount();
+        bool keepRunning = sink.consume(*frame);
+        int64_t sinkTicks = pipeline.sinkStats().addFrame(tick, allocations);
+
+        // Stages run at the same time, so the slowest one limits the frame rate
+        // Only the work of each stage is counted, so a stage held up by a slower one downstream
+        // does not look slow itself
+        if(governor != nullptr) {
+            governor->addFrame(max(frame->slowestStageTicks, sinkTicks) / getTickFrequency());
+        }
+        pipeline.recycle(move(frame));
 
-            prevCollectionTime = currentTime;
+        // Output stage statistics every 30 loop iterations
+        if(sink.framesConsumed() % 30 == 0) {
+            pipeline.printStats(cout);
         }
 
-        // Draw rejected marker candidates if needed
-        if(is.showRejected && rejected.size() > 0)
-            aruco::drawDetectedMarkers(imageCopy, rejected, noArray(), Scalar(100, 0, 255));
+        if(!keepRunning) break;
+    }
 
-        // Show camera view window with drawn information
-        imshow("Camera View", imageCopy);
+    pipeline.stop();
 
-        // Get keyboard input and stop program when the Esc key is pressed
-        char key = (char) waitKey(1);
-        if(key == 27) break;
+    if(pipeline.droppedFrames() > 0) {
+        cout << "Dropped " << pipeline.droppedFrames() << " frames while processing fell behind" << endl;
     }
 
+    finishProfile(profiler.get(), is);
     return 0;
 }
\ No newline at end of file
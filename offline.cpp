@@ -0,0 +1,345 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * offline.cpp
+ * Contains the frame-parallel and segment-parallel processing modes for recorded video.
+ */
+
+#include "offline.h"
+#include "capture.h"
+#include "detection.h"
+#include "pose.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    // Frames that can wait for a free worker for each worker thread
+    const size_t framesPerWorker = 2;
+    // Print progress every time this many frames have been written
+    const int progressInterval = 300;
+    // Shortest segment worth the cost of seeking and opening another decoder
+    const int minSegmentFrames = 100;
+    // Frames of a segment whose joint angles are calculated together
+    const size_t kinematicsBatchFrames = 32;
+
+    // Frames of a recorded video decoded and tracked by one thread
+    struct VideoSegment {
+        VideoCapture inputVideo;
+        int startFrame = 0;
+        int endFrame = 0; // One past the last frame of the segment
+        ostringstream output;
+    };
+
+    // Seek to a frame and grab it
+    // Returns false unless the timestamp of the grabbed frame, measured from the first frame's,
+    // shows the decoder landed on it
+    bool seekToFrame(VideoCapture& inputVideo, int frameIndex, double fps, double firstMsec) {
+        if(fps <= 0)
+            return false;
+
+        inputVideo.set(CAP_PROP_POS_FRAMES, frameIndex);
+        if(!inputVideo.grab())
+            return false;
+
+        // A timestamp off by half a frame period or more belongs to another frame
+        double expectedMsec = firstMsec + frameIndex * 1000.0 / fps;
+        return abs(inputVideo.get(CAP_PROP_POS_MSEC) - expectedMsec) < 500.0 / fps;
+    }
+
+    // Open a decoder for each segment and grab the frame before its first frame
+    // Returns false if any decoder failed to open or did not land exactly on that frame
+    bool openSegments(const string& inputFilename, int frameCount, double fps, double firstMsec,
+                      int numSegments, vector<unique_ptr<VideoSegment>>& segments) {
+        segments.clear();
+
+        for(int i = 0; i < numSegments; ++i) {
+            unique_ptr<VideoSegment> segment(new VideoSegment());
+            segment->startFrame = (int) ((int64_t) frameCount * i / numSegments);
+            segment->endFrame = (int) ((int64_t) frameCount * (i + 1) / numSegments);
+
+            // The frame count is only an estimate for some files, so the last segment reads to the end
+            if(i == numSegments - 1)
+                segment->endFrame = INT_MAX;
+
+            if(!segment->inputVideo.open(inputFilename))
+                return false;
+
+            // The frame before the segment is grabbed first to find where the segment starts
+            // relative to the collection periods
+            if(segment->startFrame > 0 &&
+               !seekToFrame(segment->inputVideo, segment->startFrame - 1, fps, firstMsec))
+                return false;
+
+            segments.push_back(move(segment));
+        }
+
+        return true;
+    }
+}
+
+ReorderBuffer::ReorderBuffer(size_t window) : slots(window > 0 ? window : 1) {}
+
+// Wait until the frame fits in the window and store it, returns false if the buffer is closed
+bool ReorderBuffer::insert(FramePtr frame) {
+    unique_lock<std::mutex> lock(mutex);
+    int index = frame->index;
+    slotFree.wait(lock, [&] { return index < nextIndex + (int) slots.size() || closed; });
+
+    if(closed)
+        return false;
+
+    slots[index % slots.size()] = move(frame);
+
+    if(index == nextIndex) {
+        lock.unlock();
+        frameReady.notify_one();
+    }
+    return true;
+}
+
+// Wait for the next frame in order, returns nullptr once the buffer is closed and
+// the next frame was never inserted
+FramePtr ReorderBuffer::next() {
+    unique_lock<std::mutex> lock(mutex);
+    FramePtr& slot = slots[nextIndex % slots.size()];
+    frameReady.wait(lock, [&] { return slot != nullptr || closed; });
+
+    if(slot == nullptr)
+        return nullptr;
+
+    FramePtr frame = move(slot);
+    ++nextIndex;
+
+    lock.unlock();
+    slotFree.notify_all();
+    return frame;
+}
+
+// Wake up all waiting threads and reject further inserts
+void ReorderBuffer::close() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    frameReady.notify_all();
+    slotFree.notify_all();
+}
+
+// Process a recorded video by fanning decoded frames out to worker threads that run
+// detection, pose estimation, and joint angle calculation, then pass them to the sink in frame order
+void runFrameParallel(const TrackerConfig& config, VideoCapture& inputVideo, FrameSink& sink,
+                      int numWorkers, double collectionTime) {
+    // Video files are never allowed to drop frames, so frame indices have no gaps
+    FrameRingBuffer frameBuffer(framesPerWorker * numWorkers, OVERFLOW_BLOCK);
+    // Frames are timed by video timestamps, so results do not depend on processing speed
+    CaptureThread captureThread(inputVideo, frameBuffer, true, collectionTime, config.profiler);
+    ReorderBuffer reorderBuffer(framesPerWorker * numWorkers);
+    atomic<int> activeWorkers(numWorkers);
+
+    // Enough frames to fill the reorder window while every worker and the sink hold one
+    FramePool framePool(framesPerWorker * numWorkers + numWorkers + 1);
+
+    auto runWorker = [&] {
+        CapturedFrame captured;
+        nameProfiledThread(config, "Worker");
+        // Frames reach each worker out of order, so markers are not tracked between them
+        MarkerDetector markerDetector(config, false);
+
+        while(frameBuffer.pop(captured)) {
+            FramePtr frame = framePool.acquire();
+            if(frame == nullptr)
+                break;
+
+            swap(frame->image, captured.image);
+            frame->index = captured.index;
+            frame->time = captured.time;
+
+            markerDetector.detect(*frame);
+            estimateFramePose(config, *frame);
+            computeFrameKinematics(config, *frame);
+
+            if(!reorderBuffer.insert(move(frame)))
+                break;
+        }
+
+        // The last worker to finish tells the sink that no more frames are coming
+        if(--activeWorkers == 0)
+            reorderBuffer.close();
+    };
+
+    captureThread.start();
+    vector<thread> workers;
+    for(int i = 0; i < numWorkers; ++i) {
+        workers.emplace_back(runWorker);
+    }
+
+    int64_t startTick = getTickCount();
+
+    while(FramePtr frame = reorderBuffer.next()) {
+        if(!sink.consume(*frame))
+            break;
+
+        framePool.release(move(frame));
+
+        if(sink.framesConsumed() % progressInterval == 0) {
+            double elapsed = (getTickCount() - startTick) / getTickFrequency();
+            cout << "Processed " << sink.framesConsumed() << " frames ("
+                 << sink.framesConsumed() / elapsed << " fps)" << endl;
+        }
+    }
+
+    // Stop decoding and release any workers still waiting on the reorder buffer
+    captureThread.stop();
+    reorderBuffer.close();
+    framePool.close();
+    for(thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Process a recorded video split into time segments, each decoded by its own VideoCapture and
+// tracked on its own thread, then write the results of every segment to the output file in order
+// Only the first frame of each collection period is decoded if collectionTime is positive
+// Returns false if the video could not be opened
+bool runSegmentParallel(const TrackerConfig& config, const string& inputFilename,
+                        ostream& outputFile, double collectionTime, int numSegments) {
+    VideoCapture probe(inputFilename);
+    if(!probe.isOpened()) {
+        cerr << "Video file \"" << inputFilename << "\" failed to open" << endl;
+        return false;
+    }
+    int frameCount = (int) probe.get(CAP_PROP_FRAME_COUNT);
+    double fps = probe.get(CAP_PROP_FPS);
+    // Seeks are checked against timestamps measured from the first frame's, since some streams
+    // do not start at 0
+    double firstMsec = probe.grab() ? probe.get(CAP_PROP_POS_MSEC) : 0;
+    probe.release();
+
+    // Use fewer segments for short videos or videos with an unknown length
+    numSegments = max(1, min(numSegments, frameCount / minSegmentFrames));
+
+    vector<unique_ptr<VideoSegment>> segments;
+    if(!openSegments(inputFilename, frameCount, fps, firstMsec, numSegments, segments)) {
+        // Streams with a variable frame rate or edit lists do not seek to exact frames
+        cerr << "Video file does not support accurate seeking, processing it as one segment" << endl;
+        numSegments = 1;
+        if(!openSegments(inputFilename, frameCount, fps, firstMsec, numSegments, segments)) {
+            cerr << "Video file \"" << inputFilename << "\" failed to open" << endl;
+            return false;
+        }
+    }
+
+    cout << "Processing " << frameCount << " frames in " << numSegments << " segments" << endl;
+
+    atomic<int> framesProcessed(0);
+    atomic<int> activeSegments(numSegments);
+
+    auto runSegment = [&](VideoSegment& segment) {
+        // Frames are selected by the schedule, so the sink writes every frame it gets
+        FrameSink sink(config, segment.output, 0, false);
+        CollectionSchedule schedule(collectionTime);
+        // Collected frames of a segment are in order, so markers can be tracked between them
+        MarkerDetector markerDetector(config);
+        PoseEstimator poseEstimator(config);
+        nameProfiledThread(config, "Segment");
+
+        // Joint angles are calculated for a batch of frames at once, then the batch is written
+        // Images are not needed once poses are estimated, so the whole batch is decoded into one image
+        vector<FrameState> batch(kinematicsBatchFrames);
+        vector<FrameState*> batchFrames;
+        FrameArena batchArena;
+        Mat image;
+
+        auto writeBatch = [&] {
+            batchArena.reset();
+            computeBatchKinematics(config, batchFrames.data(), batchFrames.size(), batchArena);
+            for(FrameState* batchFrame : batchFrames) {
+                sink.consume(*batchFrame);
+            }
+            batchFrames.clear();
+        };
+
+        // The frame before the segment was grabbed when its decoder was opened
+        if(segment.startFrame > 0) {
+            schedule.isCollectionFrame(getMediaTime(segment.inputVideo, segment.startFrame - 1, fps));
+        }
+
+        for(int frameIndex = segment.startFrame;
+            frameIndex < segment.endFrame && grabFrame(segment.inputVideo, config.profiler); ++frameIndex) {
+            ++framesProcessed;
+
+            // Media timestamps keep the time column consistent across segments
+            double mediaTime = getMediaTime(segment.inputVideo, frameIndex, fps);
+
+            // Skip decoding frames that fall between collection points
+            if(!schedule.isCollectionFrame(mediaTime))
+                continue;
+
+            // The frame states of the batch are reused for the whole segment
+            FrameState& frame = batch[batchFrames.size()];
+            frame.reset();
+            retrieveFrame(segment.inputVideo, image, config.profiler);
+            frame.image = image;
+            frame.index = frameIndex;
+            frame.time = mediaTime;
+
+            markerDetector.detect(frame);
+            poseEstimator.estimate(frame);
+
+            // Let go of the image, so the next frame is decoded into the same buffer
+            frame.image.release();
+            batchFrames.push_back(&frame);
+            if(batchFrames.size() == batch.size())
+                writeBatch();
+        }
+        writeBatch();
+
+        --activeSegments;
+    };
+
+    int64_t startTick = getTickCount();
+    vector<thread> threads;
+    for(unique_ptr<VideoSegment>& segment : segments) {
+        threads.emplace_back(runSegment, ref(*segment));
+    }
+
+    // Print progress while the segments are processed
+    int64_t lastProgressTick = startTick;
+    while(activeSegments > 0) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+
+        if((getTickCount() - lastProgressTick) / getTickFrequency() >= 5.0) {
+            lastProgressTick = getTickCount();
+            double elapsed = (lastProgressTick - startTick) / getTickFrequency();
+            cout << "Processed " << framesProcessed << " of " << frameCount << " frames ("
+                 << framesProcessed / elapsed << " fps)" << endl;
+        }
+    }
+
+    for(thread& segmentThread : threads) {
+        segmentThread.join();
+    }
+
+    // Merge segment results in time order
+    for(unique_ptr<VideoSegment>& segment : segments) {
+        outputFile << segment->output.str();
+    }
+    outputFile.flush();
+
+    double elapsed = (getTickCount() - startTick) / getTickFrequency();
+    cout << "Processed " << framesProcessed << " frames in " << elapsed << " s" << endl;
+
+    return true;
+}
@@ -0,0 +1,56 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * offline.h
+ * Contains processing modes for recorded video, where every frame is independent
+ * and can be processed out of order on multiple cores.
+ */
+
+#pragma once
+
+#include "pipeline.h"
+#include "tracking.h"
+#include <opencv2/videoio.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Collects frames finished out of order by worker threads and releases them in frame order
+class ReorderBuffer {
+public:
+    // Frames more than window frames ahead of the next frame in order wait to be inserted
+    explicit ReorderBuffer(size_t window);
+
+    // Wait until the frame fits in the window and store it, returns false if the buffer is closed
+    bool insert(FramePtr frame);
+    // Wait for the next frame in order, returns nullptr once the buffer is closed and
+    // the next frame was never inserted
+    FramePtr next();
+    // Wake up all waiting threads and reject further inserts
+    void close();
+
+private:
+    std::vector<FramePtr> slots;
+    int nextIndex = 0;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    std::condition_variable slotFree;
+};
+
+// Process a recorded video by fanning decoded frames out to worker threads that run
+// detection, pose estimation, and joint angle calculation, then pass them to the sink in frame order
+// Only the first frame of each collection period is decoded if collectionTime is positive
+void runFrameParallel(const TrackerConfig& config, cv::VideoCapture& inputVideo, FrameSink& sink,
+                      int numWorkers, double collectionTime);
+
+// Process a recorded video split into time segments, each decoded by its own VideoCapture and
+// tracked on its own thread, then write the results of every segment to the output file in order
+// Only the first frame of each collection period is decoded if collectionTime is positive
+// Returns false if the video could not be opened
+bool runSegmentParallel(const TrackerConfig& config, const std::string& inputFilename,
+                        std::ostream& outputFile, double collectionTime, int numSegments);
@@ -0,0 +1,315 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * pipeline.cpp
+ * Contains the staged tracking pipeline and its per-stage statistics.
+ */
+
+#include "pipeline.h"
+#include "alloc_counter.h"
+#include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    // Stages that each process one frame at a time, counting the sink
+    const size_t numStages = 4;
+    // Number of frames that can wait between two processing stages for video files
+    const size_t fileQueueCapacity = 8;
+    // Number of frames that can wait between all stages together when frames may be dropped
+    const size_t liveWaitingFrames = 2;
+
+    // Input that drops frames keeps only a few waiting between stages, so a slow stage makes the
+    // frame buffer drop stale frames instead of letting them queue up and lag behind the camera
+    size_t stageQueueCapacity(OverflowPolicy overflowPolicy) {
+        return overflowPolicy == OVERFLOW_BLOCK ? fileQueueCapacity : liveWaitingFrames;
+    }
+
+    // Enough frames to fill every stage queue, plus one being processed by each stage
+    // With dropped frames, the pool holds fewer frames than the queues, so it limits their depth
+    size_t pipelineFrames(OverflowPolicy overflowPolicy) {
+        if(overflowPolicy == OVERFLOW_BLOCK)
+            return 3 * fileQueueCapacity + numStages;
+        return liveWaitingFrames + numStages;
+    }
+}
+
+FramePool::FramePool(size_t size) {
+    for(size_t i = 0; i < size; ++i) {
+        frames.emplace_back(new FrameState());
+    }
+}
+
+// Wait for a free frame and reset it, returns nullptr once the pool is closed
+FramePtr FramePool::acquire() {
+    unique_lock<std::mutex> lock(mutex);
+    frameFree.wait(lock, [this] { return !frames.empty() || closed; });
+
+    if(closed)
+        return nullptr;
+
+    FramePtr frame = move(frames.back());
+    frames.pop_back();
+    lock.unlock();
+
+    frame->reset();
+    return frame;
+}
+
+// Give a frame back to the pool, empty frames are ignored
+void FramePool::release(FramePtr frame) {
+    if(frame == nullptr)
+        return;
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        frames.push_back(move(frame));
+    }
+    frameFree.notify_one();
+}
+
+// Wake up all waiting threads
+void FramePool::close() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    frameFree.notify_all();
+}
+
+StageStats::StageStats(const char* name) : name(name), frames(0), busyTicks(0), allocations(0) {}
+
+// Record one processed frame that started processing at the given tick count
+// and allocation count of the processing thread, returns the ticks it took
+int64_t StageStats::addFrame(int64_t startTick, int64_t startAllocations) {
+    int64_t ticks = getTickCount() - startTick;
+    busyTicks += ticks;
+    allocations += threadAllocationCount() - startAllocations;
+    ++frames;
+    return ticks;
+}
+
+FrameSink::FrameSink(const TrackerConfig& config, ostream& outputFile, double collectionTime,
+                     bool showWindow)
+    : config(config), outputFile(outputFile), collectionTime(collectionTime), showWindow(showWindow) {}
+
+// Returns false when the Esc key is pressed in the camera view window
+bool FrameSink::consume(const FrameState& frame) {
+    ++totalIterations;
+
+    // Write data to file if enough time has passed or first iteration
+    if(frame.time - prevCollectionTime >= collectionTime || totalIterations == 1) {
+        writeOutputRow(outputFile, config, frame);
+        prevCollectionTime = frame.time;
+    }
+
+    if(config.profiler != nullptr) {
+        config.profiler->writeReportIfDue();
+    }
+
+    if(!showWindow)
+        return true;
+
+    if(config.governor != nullptr && config.governor->level() >= QUALITY_SPARSE_DRAWING &&
+       totalIterations % 2 == 0)
+        return true;
+
+    // Show camera view window with drawn information
+    drawFrame(config, frame, imageCopy);
+
+    ScopedStageTimer timer(config.profiler, STAGE_DISPLAY);
+    imshow("Camera View", imageCopy);
+
+    // Get keyboard input and stop program when the Esc key is pressed
+    char key = (char) waitKey(1);
+    return key != 27;
+}
+
+int FrameSink::framesConsumed() const {
+    return totalIterations;
+}
+
+Pipeline::Pipeline(const TrackerConfig& config, VideoCapture& inputVideo, size_t bufferCapacity,
+                   OverflowPolicy overflowPolicy, bool useMediaTime, double collectionTime)
+    : config(config),
+      framePool(pipelineFrames(overflowPolicy)),
+      frameBuffer(bufferCapacity, overflowPolicy),
+      captureThread(inputVideo, frameBuffer, useMediaTime, collectionTime, config.profiler),
+      markerDetector(config),
+      poseEstimator(config),
+      detectQueue(stageQueueCapacity(overflowPolicy)),
+      poseQueue(stageQueueCapacity(overflowPolicy)),
+      kinematicsQueue(stageQueueCapacity(overflowPolicy)),
+      detectStats("Detect"),
+      poseStats("Pose"),
+      kinematicsStats("Kinematics"),
+      sinkStageStats("Sink"),
+      stopRequested(false) {}
+
+Pipeline::~Pipeline() {
+    stop();
+}
+
+void Pipeline::start() {
+    stopRequested = false;
+    lastReportTick = getTickCount();
+
+    captureThread.start();
+    detectThread = thread(&Pipeline::runDetect, this);
+    poseThread = thread(&Pipeline::runStage, this, ref(detectQueue), ref(poseQueue), ref(poseStats),
+                        [this](FrameState& frame) { poseEstimator.estimate(frame); });
+    kinematicsThread = thread(&Pipeline::runStage, this, ref(poseQueue), ref(kinematicsQueue),
+                              ref(kinematicsStats),
+                              [this](FrameState& frame) { computeFrameKinematics(config, frame); });
+}
+
+// Stop every stage and wait for their threads to exit
+void Pipeline::stop() {
+    stopRequested = true;
+    captureThread.stop();
+    framePool.close();
+
+    if(detectThread.joinable())
+        detectThread.join();
+    if(poseThread.joinable())
+        poseThread.join();
+    if(kinematicsThread.joinable())
+        kinematicsThread.join();
+}
+
+// Wait for the next fully processed frame, returns nullptr once the input has ended
+FramePtr Pipeline::next() {
+    FramePtr frame;
+    kinematicsQueue.pop(frame, stopRequested);
+    return frame;
+}
+
+// Give a frame returned by next back to the pipeline once the sink is done with it
+void Pipeline::recycle(FramePtr frame) {
+    framePool.release(move(frame));
+}
+
+StageStats& Pipeline::sinkStats() {
+    return sinkStageStats;
+}
+
+size_t Pipeline::droppedFrames() const {
+    return frameBuffer.droppedFrames();
+}
+
+// Take captured frames from the ring buffer and detect their markers
+void Pipeline::runDetect() {
+    CapturedFrame captured;
+    nameProfiledThread(config, detectStats.name);
+
+    while(frameBuffer.pop(captured)) {
+        // Waiting for a free frame while later stages are behind is not counted as detection time
+        FramePtr frame = framePool.acquire();
+        if(frame == nullptr)
+            return;
+
+        int64_t tick = getTickCount();
+        int64_t allocations = threadAllocationCount();
+
+        // The frame's previous image buffer goes back to the ring buffer to be decoded into
+        swap(frame->image, captured.image);
+        frame->index = captured.index;
+        frame->time = captured.time;
+
+        markerDetector.detect(*frame);
+        frame->slowestStageTicks = detectStats.addFrame(tick, allocations);
+
+        if(!detectQueue.push(frame, stopRequested))
+            return;
+    }
+
+    // An empty frame marks the end of the input for the following stages
+    FramePtr endOfInput;
+    detectQueue.push(endOfInput, stopRequested);
+}
+
+// Apply a processing step to each frame and pass it on, until the end of the input
+void Pipeline::runStage(FrameQueue& input, FrameQueue& output, StageStats& stats,
+                        function<void(FrameState&)> process) {
+    FramePtr frame;
+    nameProfiledThread(config, stats.name);
+
+    while(input.pop(frame, stopRequested)) {
+        bool endOfInput = (frame == nullptr);
+
+        if(!endOfInput) {
+            int64_t tick = getTickCount();
+            int64_t allocations = threadAllocationCount();
+            process(*frame);
+            frame->slowestStageTicks = max(frame->slowestStageTicks, stats.addFrame(tick, allocations));
+        }
+
+        if(!output.push(frame, stopRequested) || endOfInput)
+            return;
+    }
+}
+
+// Print throughput, time per frame, and input queue depth of each stage
+void Pipeline::printStats(ostream& out) {
+    int64_t tick = getTickCount();
+    double elapsed = (tick - lastReportTick) / getTickFrequency();
+    lastReportTick = tick;
+
+    if(elapsed <= 0)
+        return;
+
+    int64_t captured = captureThread.grabbedFrames();
+    out << "Capture: " << (captured - reportedCaptureFrames) / elapsed << " fps, queue "
+        << frameBuffer.size() << "/" << frameBuffer.capacity() << ", "
+        << frameBuffer.droppedFrames() << " dropped" << endl;
+    reportedCaptureFrames = captured;
+
+    printStageStats(out, detectStats, elapsed, frameBuffer.size(), frameBuffer.capacity());
+    if(config.fullScanInterval > 0 || config.flowSearchInterval > 1) {
+        out << "Marker tracking: " << markerDetector.fullScans() << " full-frame searches, "
+            << markerDetector.regionScans() << " region searches, " << markerDetector.flowFrames()
+            << " optical flow frames" << endl;
+    }
+    if(config.motionThreshold > 0) {
+        out << "Motion gate: " << markerDetector.reusedFrames() << " unchanged frames reused" << endl;
+    }
+    if(config.governor != nullptr) {
+        out << "Quality: " << qualityLevelName(config.governor->level()) << ", "
+            << 1000 * config.governor->frameTime() << " ms/frame of "
+            << 1000 / config.governor->targetFps() << " ms budget" << endl;
+    }
+    printStageStats(out, poseStats, elapsed, detectQueue.size(), detectQueue.capacity());
+    if(config.warmStartPoses) {
+        out << "Pose warm starts: " << poseEstimator.warmStarts() << ", solved again after a poor fit: "
+            << poseEstimator.fallbacks() << endl;
+    }
+    printStageStats(out, kinematicsStats, elapsed, poseQueue.size(), poseQueue.capacity());
+    printStageStats(out, sinkStageStats, elapsed, kinematicsQueue.size(), kinematicsQueue.capacity());
+}
+
+// Print the statistics of one stage since its last report
+void Pipeline::printStageStats(ostream& out, StageStats& stats, double elapsed, size_t queueDepth,
+                               size_t queueCapacity) {
+    int64_t frames = stats.frames;
+    int64_t busyTicks = stats.busyTicks;
+    int64_t allocations = stats.allocations;
+    int64_t newFrames = frames - stats.reportedFrames;
+
+    double meanTime = 0;
+    double meanAllocations = 0;
+    if(newFrames > 0) {
+        meanTime = 1000 * (busyTicks - stats.reportedBusyTicks) / getTickFrequency() / newFrames;
+        meanAllocations = (double) (allocations - stats.reportedAllocations) / newFrames;
+    }
+
+    out << stats.name << ": " << newFrames / elapsed << " fps, " << meanTime << " ms/frame, "
+        << meanAllocations << " allocations/frame, queue " << queueDepth << "/" << queueCapacity << endl;
+
+    stats.reportedFrames = frames;
+    stats.reportedBusyTicks = busyTicks;
+    stats.reportedAllocations = allocations;
+}
@@ -0,0 +1,149 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * pipeline.h
+ * Contains the staged tracking pipeline. Capture, detection, pose estimation, and
+ * joint angle calculation each run on their own thread, so consecutive frames overlap.
+ * The final sink stage (drawing, output, and display) runs on the caller's thread.
+ */
+
+#pragma once
+
+#include "capture.h"
+#include "detection.h"
+#include "pose.h"
+#include "spsc_queue.h"
+#include "tracking.h"
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+typedef std::unique_ptr<FrameState> FramePtr;
+typedef SpscQueue<FramePtr> FrameQueue;
+
+// Fixed set of preallocated frames that are reused instead of allocating a frame per image
+class FramePool {
+public:
+    explicit FramePool(size_t size);
+
+    // Wait for a free frame and reset it, returns nullptr once the pool is closed
+    FramePtr acquire();
+    // Give a frame back to the pool, empty frames are ignored
+    void release(FramePtr frame);
+    // Wake up all waiting threads
+    void close();
+
+private:
+    std::vector<FramePtr> frames;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable frameFree;
+};
+
+// Number of frames processed by one stage, the time spent processing them,
+// and the heap allocations they caused
+class StageStats {
+public:
+    explicit StageStats(const char* name);
+
+    // Record one processed frame that started processing at the given tick count
+    // and allocation count of the processing thread, returns the ticks it took
+    int64_t addFrame(int64_t startTick, int64_t startAllocations);
+
+    const char* name;
+    std::atomic<int64_t> frames;
+    std::atomic<int64_t> busyTicks;
+    std::atomic<int64_t> allocations;
+
+    // Values at the last report, only used by the reporting thread
+    int64_t reportedFrames = 0;
+    int64_t reportedBusyTicks = 0;
+    int64_t reportedAllocations = 0;
+};
+
+// Final stage: draws, writes, and displays processed frames in the order they are given
+class FrameSink {
+public:
+    FrameSink(const TrackerConfig& config, std::ostream& outputFile, double collectionTime,
+              bool showWindow);
+
+    // Returns false when the Esc key is pressed in the camera view window
+    // At the governor's sparse drawing level, only every other frame is drawn and shown
+    bool consume(const FrameState& frame);
+
+    int framesConsumed() const;
+
+private:
+    const TrackerConfig& config;
+    std::ostream& outputFile;
+    double collectionTime;
+    bool showWindow;
+
+    cv::Mat imageCopy;
+    int totalIterations = 0;
+    double prevCollectionTime = 0;
+};
+
+class Pipeline {
+public:
+    // useMediaTime and collectionTime are passed to the capture thread, see CaptureThread
+    Pipeline(const TrackerConfig& config, cv::VideoCapture& inputVideo, size_t bufferCapacity,
+             OverflowPolicy overflowPolicy, bool useMediaTime, double collectionTime);
+    ~Pipeline();
+
+    void start();
+    // Stop every stage and wait for their threads to exit
+    void stop();
+
+    // Wait for the next fully processed frame, returns nullptr once the input has ended
+    FramePtr next();
+    // Give a frame returned by next back to the pipeline once the sink is done with it
+    void recycle(FramePtr frame);
+
+    // Statistics for the sink stage, which is run by the caller
+    StageStats& sinkStats();
+    // Print throughput, time per frame, and input queue depth of each stage
+    void printStats(std::ostream& out);
+
+    size_t droppedFrames() const;
+
+private:
+    void runDetect();
+    void runStage(FrameQueue& input, FrameQueue& output, StageStats& stats,
+                  std::function<void(FrameState&)> process);
+    void printStageStats(std::ostream& out, StageStats& stats, double elapsed, size_t queueDepth,
+                         size_t queueCapacity);
+
+    const TrackerConfig& config;
+
+    FramePool framePool;
+    FrameRingBuffer frameBuffer;
+    CaptureThread captureThread;
+    MarkerDetector markerDetector;
+    PoseEstimator poseEstimator;
+    FrameQueue detectQueue;
+    FrameQueue poseQueue;
+    FrameQueue kinematicsQueue;
+
+    StageStats detectStats;
+    StageStats poseStats;
+    StageStats kinematicsStats;
+    StageStats sinkStageStats;
+
+    std::thread detectThread;
+    std::thread poseThread;
+    std::thread kinematicsThread;
+    std::atomic<bool> stopRequested;
+
+    int64_t lastReportTick = 0;
+    int64_t reportedCaptureFrames = 0;
+};
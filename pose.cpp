@@ -0,0 +1,142 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * pose.cpp
+ * Contains the pose estimator that starts each marker's solve from its last pose.
+ */
+
+#include "pose.h"
+#include <opencv2/calib3d.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    // Iterations of refining a pose from the last frame, a full solve takes up to 20
+    const int warmStartIterations = 5;
+    // Largest root mean square distance in pixels between the corners and the refined pose's
+    // projection of them, above which the marker is solved from scratch
+    const double maxWarmStartError = 1.0;
+}
+
+PoseEstimator::PoseEstimator(const TrackerConfig& config, bool consecutiveFrames)
+    : config(config), consecutiveFrames(consecutiveFrames),
+      objectPoints(markerObjectPoints(config.markerLength)), numWarmStarts(0), numFallbacks(0) {}
+
+// Estimate the pose and image position of each detected marker
+void PoseEstimator::estimate(FrameState& frame) {
+    bool useWarmStart = consecutiveFrames && config.warmStartPoses;
+    const JointGraph& graph = config.jointGraph;
+    if(useWarmStart) {
+        lastRvecs.resize(graph.numMarkers());
+        lastTvecs.resize(graph.numMarkers());
+        seenLastFrame.resize(graph.numMarkers(), false);
+    }
+
+    if(!config.estimatePose || frame.ids.size() == 0) {
+        fill(seenLastFrame.begin(), seenLastFrame.end(), false);
+        heldRvecs.clear();
+        heldTvecs.clear();
+        return;
+    }
+
+    ScopedStageTimer timer(config.profiler, STAGE_POSE, frame.index);
+
+    int numIDs = frame.ids.size();
+    if(frame.posesReused && heldRvecs.size() == frame.ids.size()) {
+        // Detection reused the markers of the last frame, so its poses are reused as they are
+        frame.rvecs.assign(heldRvecs.begin(), heldRvecs.end());
+        frame.tvecs.assign(heldTvecs.begin(), heldTvecs.end());
+    }
+    else {
+        frame.rvecs.resize(numIDs);
+        frame.tvecs.resize(numIDs);
+
+        for(int i = 0; i < numIDs; ++i) {
+            int id = frame.ids[i];
+            if(frame.baseLocked && id == 0) {
+                frame.rvecs[i] = frame.baseRvec;
+                frame.tvecs[i] = frame.baseTvec;
+                continue;
+            }
+
+            // Refine markers seen in the last frame from their last pose, and solve the others
+            // or any that do not fit from scratch
+            int slot = graph.slotOf(id);
+            bool warm = useWarmStart && slot >= 0 && seenLastFrame[slot];
+            if(warm) {
+                ScopedTraceEvent event(config.profiler, "solvePnPRefineLM", "id", id);
+                frame.rvecs[i] = lastRvecs[slot];
+                frame.tvecs[i] = lastTvecs[slot];
+                ++numWarmStarts;
+                if(refinePose(frame.corners[i], frame.rvecs[i], frame.tvecs[i]))
+                    continue;
+                ++numFallbacks;
+            }
+
+            ScopedTraceEvent event(config.profiler, "solvePnP", "id", id);
+            solveMarkerPose(config, frame.corners[i], frame.rvecs[i], frame.tvecs[i]);
+        }
+    }
+
+    projectMarkerOrigins(config, frame);
+
+    heldRvecs.assign(frame.rvecs.begin(), frame.rvecs.end());
+    heldTvecs.assign(frame.tvecs.begin(), frame.tvecs.end());
+
+    if(!useWarmStart)
+        return;
+
+    fill(seenLastFrame.begin(), seenLastFrame.end(), false);
+    for(int i = 0; i < numIDs; ++i) {
+        int slot = graph.slotOf(frame.ids[i]);
+        if(slot >= 0) {
+            lastRvecs[slot] = frame.rvecs[i];
+            lastTvecs[slot] = frame.tvecs[i];
+            seenLastFrame[slot] = true;
+        }
+    }
+}
+
+// Returns false if the pose refined from the given starting pose does not fit the corners
+bool PoseEstimator::refinePose(const vector<Point2f>& corners, Vec3d& rvec, Vec3d& tvec) {
+    Mat objectPointsMat(4, 1, CV_32FC3, objectPoints.val);
+    TermCriteria criteria(TermCriteria::COUNT | TermCriteria::EPS, warmStartIterations, FLT_EPSILON);
+
+    // With a camera model, the pose is refined against undistorted corners in normalized
+    // coordinates, where errors are measured in units of the focal length
+    const vector<Point2f>* fitCorners = &corners;
+    double pixelsPerUnit = 1.0;
+    if(config.cameraModel != nullptr) {
+        normalizedCorners.resize(corners.size());
+        config.cameraModel->undistort(corners.data(), normalizedCorners.data(), corners.size());
+        fitCorners = &normalizedCorners;
+        pixelsPerUnit = config.cameraModel->focalLength();
+
+        solvePnPRefineLM(objectPointsMat, normalizedCorners, Matx33d::eye(), noArray(), rvec, tvec, criteria);
+        projectPoints(objectPointsMat, rvec, tvec, Matx33d::eye(), noArray(), projectedCorners);
+    }
+    else {
+        solvePnPRefineLM(objectPointsMat, corners, config.camMatrix, config.distCoeffs, rvec, tvec, criteria);
+        projectPoints(objectPointsMat, rvec, tvec, config.camMatrix, config.distCoeffs, projectedCorners);
+    }
+
+    double squaredError = 0;
+    for(size_t i = 0; i < fitCorners->size(); ++i) {
+        Point2f difference = projectedCorners[i] - (*fitCorners)[i];
+        squaredError += difference.dot(difference);
+    }
+    return sqrt(squaredError / fitCorners->size()) * pixelsPerUnit <= maxWarmStartError;
+}
+
+int64_t PoseEstimator::warmStarts() const {
+    return numWarmStarts;
+}
+
+int64_t PoseEstimator::fallbacks() const {
+    return numFallbacks;
+}
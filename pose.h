@@ -0,0 +1,52 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * pose.h
+ * Contains a pose estimator that keeps the pose of each marker between consecutive frames
+ * of one video, so each solve can start from where the marker was in the last frame.
+ */
+
+#pragma once
+
+#include "tracking.h"
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Estimates marker poses in consecutive frames of one video
+// With warm starts enabled, markers seen in the last frame are refined from their last pose with
+// a few iterations, and solved from scratch only if the refined pose does not fit their corners,
+// which is faster and keeps near-frontal markers from flipping between ambiguous poses
+class PoseEstimator {
+public:
+    // Warm starts are only used if consecutiveFrames is set, for frames that are passed in order
+    explicit PoseEstimator(const TrackerConfig& config, bool consecutiveFrames = true);
+
+    // Estimate the pose and image position of each detected marker
+    void estimate(FrameState& frame);
+
+    // Number of poses refined from the last frame, and of refined poses that were solved again
+    // from scratch because they did not fit, safe to call from any thread
+    int64_t warmStarts() const;
+    int64_t fallbacks() const;
+
+private:
+    // Returns false if the pose refined from the given starting pose does not fit the corners
+    bool refinePose(const std::vector<cv::Point2f>& corners, cv::Vec3d& rvec, cv::Vec3d& tvec);
+
+    const TrackerConfig& config;
+    bool consecutiveFrames;
+    cv::Matx43f objectPoints;
+    std::vector<cv::Point2f> normalizedCorners, projectedCorners;
+
+    // Pose of each marker in the last frame by joint graph slot, and whether it was seen there
+    std::vector<cv::Vec3d> lastRvecs, lastTvecs;
+    std::vector<bool> seenLastFrame;
+    // Poses of the last frame in its marker order, copied to frames whose markers were reused
+    std::vector<cv::Vec3d> heldRvecs, heldTvecs;
+
+    std::atomic<int64_t> numWarmStarts;
+    std::atomic<int64_t> numFallbacks;
+};
@@ -0,0 +1,251 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * profiler.cpp
+ * Contains the latency histogram, profiler, and report writing.
+ */
+
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+using namespace std;
+
+namespace {
+    const char* stageNames[STAGE_COUNT] = {"grab", "retrieve", "detect", "pose", "kinematics",
+                                           "draw", "write", "display"};
+
+    // Position of the highest set bit of a positive value
+    int highestBit(int64_t value) {
+        int bit = 0;
+        while(value >>= 1) {
+            ++bit;
+        }
+        return bit;
+    }
+
+    double toMilliseconds(double nanoseconds) {
+        return nanoseconds / 1e6;
+    }
+}
+
+// Lowercase name of a profiler stage, used in reports
+const char* profileStageName(ProfileStage stage) {
+    return stageNames[stage];
+}
+
+// Monotonic clock time in nanoseconds
+int64_t nowNanoseconds() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LatencyHistogram::LatencyHistogram() : totalCount(0), totalNanoseconds(0), maxValue(0) {
+    for(int i = 0; i < bucketCount; ++i) {
+        buckets[i] = 0;
+    }
+}
+
+int LatencyHistogram::bucketIndex(int64_t value) {
+    if(value < subBucketCount)
+        return (int) std::max<int64_t>(value, 0);
+
+    int exponent = highestBit(value);
+    if(exponent > maxExponent)
+        return bucketCount - 1;
+
+    // The bits below the highest set bit select the sub-bucket
+    int shift = exponent - subBucketBits;
+    int subBucket = (int) ((value >> shift) & (subBucketCount - 1));
+    return subBucketCount + shift * subBucketCount + subBucket;
+}
+
+int64_t LatencyHistogram::bucketUpperValue(int index) {
+    if(index < subBucketCount)
+        return index;
+
+    int shift = (index - subBucketCount) / subBucketCount;
+    int64_t subBucket = (index - subBucketCount) % subBucketCount;
+    int64_t lowerValue = (subBucketCount + subBucket) << shift;
+    return lowerValue + ((int64_t) 1 << shift) - 1;
+}
+
+void LatencyHistogram::record(int64_t nanoseconds) {
+    buckets[bucketIndex(nanoseconds)].fetch_add(1, memory_order_relaxed);
+    totalCount.fetch_add(1, memory_order_relaxed);
+    totalNanoseconds.fetch_add(nanoseconds, memory_order_relaxed);
+
+    int64_t curMax = maxValue.load(memory_order_relaxed);
+    while(nanoseconds > curMax && !maxValue.compare_exchange_weak(curMax, nanoseconds)) {}
+}
+
+int64_t LatencyHistogram::count() const {
+    return totalCount;
+}
+
+double LatencyHistogram::mean() const {
+    int64_t n = totalCount;
+    return n > 0 ? (double) totalNanoseconds / n : 0;
+}
+
+int64_t LatencyHistogram::max() const {
+    return maxValue;
+}
+
+// Smallest recorded value that at least fraction p of the values are less than or equal to,
+// rounded up to the upper edge of its bucket
+int64_t LatencyHistogram::percentile(double p) const {
+    int64_t n = totalCount;
+    if(n == 0)
+        return 0;
+
+    int64_t target = std::max<int64_t>(1, (int64_t) ceil(p * n));
+    int64_t cumulative = 0;
+
+    for(int i = 0; i < bucketCount; ++i) {
+        cumulative += buckets[i];
+        if(cumulative >= target)
+            return std::min(bucketUpperValue(i), max());
+    }
+    return max();
+}
+
+Profiler::Profiler(const string& reportFilename, double reportInterval)
+    : reportFilename(reportFilename),
+      reportIntervalNanoseconds((int64_t) (reportInterval * 1e9)),
+      lastReportTime(nowNanoseconds()) {}
+
+// Record a stage that ran from startTime to endTime, frameIndex is negative if unknown
+void Profiler::record(ProfileStage stage, int64_t startTime, int64_t endTime, int frameIndex) {
+    histograms[stage].record(endTime - startTime);
+
+    if(traceRecorder != nullptr) {
+        TraceEvent event = {stageNames[stage], startTime, endTime, nullptr, 0};
+        if(frameIndex >= 0) {
+            event.argName = "frame";
+            event.arg = frameIndex;
+        }
+        traceRecorder->addEvent(event);
+    }
+}
+
+void Profiler::setTrace(TraceRecorder* trace) {
+    traceRecorder = trace;
+}
+
+TraceRecorder* Profiler::trace() const {
+    return traceRecorder;
+}
+
+// Label the calling thread in the trace, if there is one
+void Profiler::nameThread(const char* name) {
+    if(traceRecorder != nullptr) {
+        traceRecorder->nameThread(name);
+    }
+}
+
+// Write the report if the report interval has passed since it was last written
+void Profiler::writeReportIfDue() {
+    if(reportFilename.empty())
+        return;
+
+    int64_t now = nowNanoseconds();
+    int64_t lastReport = lastReportTime;
+
+    // Only the thread that moves the report time forward writes the report
+    if(now - lastReport >= reportIntervalNanoseconds &&
+       lastReportTime.compare_exchange_strong(lastReport, now)) {
+        writeReport();
+    }
+}
+
+// Write the count, mean, p50, p90, p99, and max time of each stage to the report file
+bool Profiler::writeReport() {
+    if(reportFilename.empty())
+        return true;
+
+    ofstream reportFile(reportFilename);
+    if(!reportFile.is_open())
+        return false;
+
+    bool isJSON = reportFilename.size() >= 5 &&
+                  reportFilename.compare(reportFilename.size() - 5, 5, ".json") == 0;
+    if(isJSON) {
+        writeJSON(reportFile);
+    }
+    else {
+        writeCSV(reportFile);
+    }
+    return true;
+}
+
+void Profiler::writeJSON(ostream& out) const {
+    out << "{\n  \"units\": \"ms\",\n  \"stages\": {\n";
+
+    for(int i = 0; i < STAGE_COUNT; ++i) {
+        const LatencyHistogram& h = histograms[i];
+        out << "    \"" << stageNames[i] << "\": {\"count\": " << h.count()
+            << ", \"mean\": " << toMilliseconds(h.mean())
+            << ", \"p50\": " << toMilliseconds((double) h.percentile(0.50))
+            << ", \"p90\": " << toMilliseconds((double) h.percentile(0.90))
+            << ", \"p99\": " << toMilliseconds((double) h.percentile(0.99))
+            << ", \"max\": " << toMilliseconds((double) h.max()) << "}";
+        out << (i + 1 < STAGE_COUNT ? ",\n" : "\n");
+    }
+
+    out << "  }\n}" << endl;
+}
+
+void Profiler::writeCSV(ostream& out) const {
+    out << "Stage,Count,Mean (ms),p50 (ms),p90 (ms),p99 (ms),Max (ms)" << endl;
+
+    for(int i = 0; i < STAGE_COUNT; ++i) {
+        const LatencyHistogram& h = histograms[i];
+        out << stageNames[i] << "," << h.count() << "," << toMilliseconds(h.mean()) << ","
+            << toMilliseconds((double) h.percentile(0.50)) << ","
+            << toMilliseconds((double) h.percentile(0.90)) << ","
+            << toMilliseconds((double) h.percentile(0.99)) << ","
+            << toMilliseconds((double) h.max()) << endl;
+    }
+}
+
+// Print the same statistics as the report
+void Profiler::printSummary(ostream& out) const {
+    for(int i = 0; i < STAGE_COUNT; ++i) {
+        const LatencyHistogram& h = histograms[i];
+        if(h.count() == 0)
+            continue;
+
+        out << stageNames[i] << ": p50 = " << toMilliseconds((double) h.percentile(0.50))
+            << " ms, p90 = " << toMilliseconds((double) h.percentile(0.90))
+            << " ms, p99 = " << toMilliseconds((double) h.percentile(0.99))
+            << " ms, max = " << toMilliseconds((double) h.max()) << " ms" << endl;
+    }
+}
+
+ScopedStageTimer::ScopedStageTimer(Profiler* profiler, ProfileStage stage, int frameIndex)
+    : profiler(profiler), stage(stage), frameIndex(frameIndex),
+      startTime(profiler != nullptr ? nowNanoseconds() : 0) {}
+
+ScopedStageTimer::~ScopedStageTimer() {
+    if(profiler != nullptr) {
+        profiler->record(stage, startTime, nowNanoseconds(), frameIndex);
+    }
+}
+
+ScopedTraceEvent::ScopedTraceEvent(Profiler* profiler, const char* name, const char* argName, int64_t arg)
+    : trace(profiler != nullptr ? profiler->trace() : nullptr) {
+    if(trace != nullptr) {
+        event = {name, nowNanoseconds(), 0, argName, arg};
+    }
+}
+
+ScopedTraceEvent::~ScopedTraceEvent() {
+    if(trace != nullptr) {
+        event.endTime = nowNanoseconds();
+        trace->addEvent(event);
+    }
+}
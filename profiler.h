@@ -0,0 +1,130 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * profiler.h
+ * Contains a per-stage latency profiler that keeps a histogram of how long each
+ * processing step took for every frame and writes percentile reports.
+ */
+
+#pragma once
+
+#include "trace.h"
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Steps of processing a frame that are timed by the profiler
+enum ProfileStage {
+    STAGE_GRAB = 0,
+    STAGE_RETRIEVE,
+    STAGE_DETECT,
+    STAGE_POSE,
+    STAGE_KINEMATICS,
+    STAGE_DRAW,
+    STAGE_WRITE,
+    STAGE_DISPLAY,
+    STAGE_COUNT
+};
+
+// Lowercase name of a profiler stage, used in reports
+const char* profileStageName(ProfileStage stage);
+
+// Monotonic clock time in nanoseconds
+int64_t nowNanoseconds();
+
+// Log-linear histogram of durations in nanoseconds, with about 1.6% relative error
+// Values can be recorded from any thread without locking
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(int64_t nanoseconds);
+
+    int64_t count() const;
+    double mean() const;
+    int64_t max() const;
+    // Smallest recorded value that at least fraction p of the values are less than or equal to,
+    // rounded up to the upper edge of its bucket
+    int64_t percentile(double p) const;
+
+private:
+    // Values below 2^subBucketBits get their own bucket, larger values get
+    // 2^subBucketBits buckets for each power of two
+    static const int subBucketBits = 6;
+    static const int subBucketCount = 1 << subBucketBits;
+    // Values of 2^maxExponent nanoseconds (about 18 minutes) and above share the last bucket
+    static const int maxExponent = 40;
+    static const int bucketCount = subBucketCount * (maxExponent - subBucketBits + 2);
+
+    static int bucketIndex(int64_t value);
+    static int64_t bucketUpperValue(int index);
+
+    std::atomic<int64_t> buckets[bucketCount];
+    std::atomic<int64_t> totalCount;
+    std::atomic<int64_t> totalNanoseconds;
+    std::atomic<int64_t> maxValue;
+};
+
+// Keeps a latency histogram for each stage and writes them to a report file
+// Stage times, and other timed events, are also added to a trace recorder if one is set
+class Profiler {
+public:
+    // The report is written to reportFilename at most every reportInterval seconds by
+    // writeReportIfDue, as JSON if the filename ends in .json and as CSV otherwise
+    // No report is written if the filename is empty
+    Profiler(const std::string& reportFilename, double reportInterval);
+
+    // Record a stage that ran from startTime to endTime, frameIndex is negative if unknown
+    void record(ProfileStage stage, int64_t startTime, int64_t endTime, int frameIndex = -1);
+
+    void setTrace(TraceRecorder* trace);
+    TraceRecorder* trace() const;
+    // Label the calling thread in the trace, if there is one
+    void nameThread(const char* name);
+
+    // Write the report if the report interval has passed since it was last written
+    void writeReportIfDue();
+    // Write the count, mean, p50, p90, p99, and max time of each stage to the report file
+    bool writeReport();
+    // Print the same statistics as the report
+    void printSummary(std::ostream& out) const;
+
+private:
+    void writeJSON(std::ostream& out) const;
+    void writeCSV(std::ostream& out) const;
+
+    LatencyHistogram histograms[STAGE_COUNT];
+    TraceRecorder* traceRecorder = nullptr;
+    std::string reportFilename;
+    int64_t reportIntervalNanoseconds;
+    std::atomic<int64_t> lastReportTime;
+};
+
+// Records the time from construction to destruction in a profiler stage
+// Does nothing if the profiler is null
+class ScopedStageTimer {
+public:
+    ScopedStageTimer(Profiler* profiler, ProfileStage stage, int frameIndex = -1);
+    ~ScopedStageTimer();
+
+private:
+    Profiler* profiler;
+    ProfileStage stage;
+    int frameIndex;
+    int64_t startTime;
+};
+
+// Adds a trace event spanning its lifetime, for steps inside a stage such as a single marker
+// Does nothing if the profiler is null or has no trace recorder
+class ScopedTraceEvent {
+public:
+    // name and argName must be string literals, argName may be null
+    ScopedTraceEvent(Profiler* profiler, const char* name, const char* argName = nullptr, int64_t arg = 0);
+    ~ScopedTraceEvent();
+
+private:
+    TraceRecorder* trace;
+    TraceEvent event;
+};
@@ -0,0 +1,101 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * spsc_queue.h
+ * Contains a lock-free, fixed-capacity queue connecting exactly one producer
+ * thread to exactly one consumer thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class SpscQueue {
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 2;
+        while(size < capacity) {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // Move an item into the queue, returns false if the queue is full
+    // Only called from the producer thread
+    bool tryPush(T& item) {
+        size_t curTail = tail.load(std::memory_order_relaxed);
+        if(curTail - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+
+        slots[curTail & mask] = std::move(item);
+        tail.store(curTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Move the oldest item out of the queue, returns false if the queue is empty
+    // Only called from the consumer thread
+    bool tryPop(T& item) {
+        size_t curHead = head.load(std::memory_order_relaxed);
+        if(curHead == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[curHead & mask]);
+        head.store(curHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Wait until there is room for an item, returns false if stop is set first
+    bool push(T& item, const std::atomic<bool>& stop) {
+        for(int spins = 0; !tryPush(item); ++spins) {
+            if(stop)
+                return false;
+            backoff(spins);
+        }
+        return true;
+    }
+
+    // Wait until an item is available, returns false if stop is set first
+    bool pop(T& item, const std::atomic<bool>& stop) {
+        for(int spins = 0; !tryPop(item); ++spins) {
+            if(stop)
+                return false;
+            backoff(spins);
+        }
+        return true;
+    }
+
+    // Approximate number of queued items, safe to call from any thread
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+private:
+    // Spin briefly, then yield, then sleep so idle stages do not occupy a core
+    static void backoff(int spins) {
+        if(spins < 64)
+            return;
+        else if(spins < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    std::vector<T> slots;
+    size_t mask = 0;
+
+    // Keep the consumer and producer indices on separate cache lines
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
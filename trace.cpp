@@ -0,0 +1,111 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * trace.cpp
+ * Contains the trace recorder and Chrome trace JSON writer.
+ */
+
+#include "trace.h"
+#include "profiler.h"
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+namespace {
+    atomic<int64_t> nextRecorderID(0);
+
+    // Buffer of the recorder this thread last added an event to
+    struct CachedBuffer {
+        int64_t recorderID = -1;
+        void* buffer = nullptr;
+    };
+    thread_local CachedBuffer cachedBuffer;
+
+    // Chrome trace timestamps are in microseconds
+    double toMicroseconds(int64_t nanoseconds) {
+        return nanoseconds / 1000.0;
+    }
+}
+
+TraceRecorder::TraceRecorder(size_t maxEventsPerThread)
+    : maxEventsPerThread(maxEventsPerThread), startTime(nowNanoseconds()), recorderID(nextRecorderID++) {}
+
+// Find or create the buffer of the calling thread, only locking the first time a thread records
+TraceRecorder::ThreadBuffer& TraceRecorder::threadBuffer() {
+    if(cachedBuffer.recorderID == recorderID)
+        return *static_cast<ThreadBuffer*>(cachedBuffer.buffer);
+
+    lock_guard<std::mutex> lock(mutex);
+    threadBuffers.emplace_back(new ThreadBuffer());
+    ThreadBuffer& buffer = *threadBuffers.back();
+    buffer.threadID = (int) threadBuffers.size();
+    // Reserve space up front so recording rarely allocates
+    buffer.events.reserve(min<size_t>(maxEventsPerThread, 4096));
+
+    cachedBuffer.recorderID = recorderID;
+    cachedBuffer.buffer = &buffer;
+    return buffer;
+}
+
+void TraceRecorder::addEvent(const TraceEvent& event) {
+    ThreadBuffer& buffer = threadBuffer();
+    if(buffer.events.size() >= maxEventsPerThread) {
+        ++buffer.dropped;
+        return;
+    }
+    buffer.events.push_back(event);
+}
+
+// Label the calling thread in the timeline
+void TraceRecorder::nameThread(const char* name) {
+    threadBuffer().threadName = name;
+}
+
+// Write every event as Chrome trace JSON
+bool TraceRecorder::writeJSON(const string& filename) const {
+    ofstream traceFile(filename);
+    if(!traceFile.is_open())
+        return false;
+
+    lock_guard<std::mutex> lock(mutex);
+    traceFile << fixed << setprecision(3);
+    traceFile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    bool first = true;
+    for(const unique_ptr<ThreadBuffer>& buffer : threadBuffers) {
+        if(!buffer->threadName.empty()) {
+            traceFile << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                      << "\"tid\": " << buffer->threadID << ", \"args\": {\"name\": \""
+                      << buffer->threadName << "\"}}";
+            first = false;
+        }
+
+        // Complete events hold both the begin and end time of a span
+        for(const TraceEvent& event : buffer->events) {
+            traceFile << (first ? "" : ",\n") << "{\"name\": \"" << event.name
+                      << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadID
+                      << ", \"ts\": " << toMicroseconds(event.startTime - startTime)
+                      << ", \"dur\": " << toMicroseconds(event.endTime - event.startTime);
+            if(event.argName != nullptr) {
+                traceFile << ", \"args\": {\"" << event.argName << "\": " << event.arg << "}";
+            }
+            traceFile << "}";
+            first = false;
+        }
+    }
+
+    traceFile << "\n]}" << endl;
+    return true;
+}
+
+size_t TraceRecorder::droppedEvents() const {
+    lock_guard<std::mutex> lock(mutex);
+    size_t dropped = 0;
+    for(const unique_ptr<ThreadBuffer>& buffer : threadBuffers) {
+        dropped += buffer->dropped;
+    }
+    return dropped;
+}
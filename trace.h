@@ -0,0 +1,61 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * trace.h
+ * Contains a timeline recorder that keeps begin and end times of events on every thread
+ * and writes them in the Chrome trace event format, for viewing in chrome://tracing or Perfetto.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A timed span on one thread, with an optional integer argument such as a frame index
+struct TraceEvent {
+    const char* name;    // Must be a string literal or otherwise outlive the recorder
+    int64_t startTime;   // Nanoseconds from nowNanoseconds
+    int64_t endTime;
+    const char* argName; // Null if the event has no argument
+    int64_t arg;
+};
+
+// Collects trace events from any number of threads
+// Each thread appends to its own buffer, so recording never waits on other threads
+class TraceRecorder {
+public:
+    // Each thread keeps at most maxEventsPerThread events, later events are counted and dropped
+    explicit TraceRecorder(size_t maxEventsPerThread = 1000000);
+
+    void addEvent(const TraceEvent& event);
+    // Label the calling thread in the timeline
+    void nameThread(const char* name);
+
+    // Write every event as Chrome trace JSON
+    // Threads that add events must have stopped before this is called
+    bool writeJSON(const std::string& filename) const;
+    size_t droppedEvents() const;
+
+private:
+    struct ThreadBuffer {
+        int threadID = 0;
+        std::string threadName;
+        std::vector<TraceEvent> events;
+        size_t dropped = 0;
+    };
+
+    ThreadBuffer& threadBuffer();
+
+    size_t maxEventsPerThread;
+    int64_t startTime;
+    // Identifies this recorder in each thread's cached buffer pointer
+    int64_t recorderID;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers;
+};
@@ -0,0 +1,450 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * tracking.cpp
+ * Contains the pose estimation, joint angle, drawing, and output steps.
+ *
+ * ArUco marker detection code obtained from: https://github.com/opencv/opencv_contrib/blob/master/modules/aruco/samples/detect_markers.cpp
+ */
+
+#include "tracking.h"
+#include "kinematics.h"
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+using namespace std;
+using namespace cv;
+
+FrameArena::FrameArena(size_t initialCapacity)
+    : block(new unsigned char[initialCapacity]), blockSize(initialCapacity) {}
+
+// Get space for size bytes, only allocating memory if the block has run out
+void* FrameArena::allocateBytes(size_t size, size_t alignment) {
+    size_t start = (used + alignment - 1) / alignment * alignment;
+    if(start + size <= blockSize) {
+        used = start + size;
+        return block.get() + start;
+    }
+
+    overflow.emplace_back(new unsigned char[size + alignment]);
+    overflowBytes += size + alignment;
+
+    unsigned char* p = overflow.back().get();
+    size_t offset = (alignment - (size_t) p % alignment) % alignment;
+    return p + offset;
+}
+
+void FrameArena::reset() {
+    // Grow the block to fit everything the last frame needed
+    if(!overflow.empty()) {
+        blockSize = (blockSize + overflowBytes) * 2;
+        block.reset(new unsigned char[blockSize]);
+        overflow.clear();
+        overflowBytes = 0;
+    }
+    used = 0;
+}
+
+size_t FrameArena::capacity() const {
+    return blockSize;
+}
+
+// Clear per-frame results without releasing their memory
+void FrameState::reset() {
+    arena.reset();
+    baseLocked = false;
+    posesReused = false;
+    slowestStageTicks = 0;
+    ids.clear();
+    rvecs.clear();
+    tvecs.clear();
+    originImagePoints.clear();
+}
+
+// Read camera parameters from a given file and store them in passed variables
+bool readCameraParameters(string filename, Mat& camMatrix, Mat& distCoeffs) {
+    FileStorage fs(filename, FileStorage::READ);
+    if(!fs.isOpened())
+        return false;
+    fs["camera_matrix"] >> camMatrix;
+    fs["distortion_coefficients"] >> distCoeffs;
+    return true;
+}
+
+// Read detector parameters from a given file and store them in passed variables
+bool readDetectorParameters(string filename, Ptr<aruco::DetectorParameters>& params) {
+    FileStorage fs(filename, FileStorage::READ);
+    if(!fs.isOpened())
+        return false;
+    fs["adaptiveThreshWinSizeMin"] >> params->adaptiveThreshWinSizeMin;
+    fs["adaptiveThreshWinSizeMax"] >> params->adaptiveThreshWinSizeMax;
+    fs["adaptiveThreshWinSizeStep"] >> params->adaptiveThreshWinSizeStep;
+    fs["adaptiveThreshConstant"] >> params->adaptiveThreshConstant;
+    fs["minMarkerPerimeterRate"] >> params->minMarkerPerimeterRate;
+    fs["maxMarkerPerimeterRate"] >> params->maxMarkerPerimeterRate;
+    fs["polygonalApproxAccuracyRate"] >> params->polygonalApproxAccuracyRate;
+    fs["minCornerDistanceRate"] >> params->minCornerDistanceRate;
+    fs["minDistanceToBorder"] >> params->minDistanceToBorder;
+    fs["minMarkerDistanceRate"] >> params->minMarkerDistanceRate;
+    fs["cornerRefinementMethod"] >> params->cornerRefinementMethod;
+    fs["cornerRefinementWinSize"] >> params->cornerRefinementWinSize;
+    fs["cornerRefinementMaxIterations"] >> params->cornerRefinementMaxIterations;
+    fs["cornerRefinementMinAccuracy"] >> params->cornerRefinementMinAccuracy;
+    fs["markerBorderBits"] >> params->markerBorderBits;
+    fs["perspectiveRemovePixelPerCell"] >> params->perspectiveRemovePixelPerCell;
+    fs["perspectiveRemoveIgnoredMarginPerCell"] >> params->perspectiveRemoveIgnoredMarginPerCell;
+    fs["maxErroneousBitsInBorderRate"] >> params->maxErroneousBitsInBorderRate;
+    fs["minOtsuStdDev"] >> params->minOtsuStdDev;
+    fs["errorCorrectionRate"] >> params->errorCorrectionRate;
+    return true;
+}
+
+// Write detector parameters to a file in the format read by readDetectorParameters
+bool writeDetectorParameters(string filename, const Ptr<aruco::DetectorParameters>& params) {
+    FileStorage fs(filename, FileStorage::WRITE);
+    if(!fs.isOpened())
+        return false;
+    fs << "adaptiveThreshWinSizeMin" << params->adaptiveThreshWinSizeMin;
+    fs << "adaptiveThreshWinSizeMax" << params->adaptiveThreshWinSizeMax;
+    fs << "adaptiveThreshWinSizeStep" << params->adaptiveThreshWinSizeStep;
+    fs << "adaptiveThreshConstant" << params->adaptiveThreshConstant;
+    fs << "minMarkerPerimeterRate" << params->minMarkerPerimeterRate;
+    fs << "maxMarkerPerimeterRate" << params->maxMarkerPerimeterRate;
+    fs << "polygonalApproxAccuracyRate" << params->polygonalApproxAccuracyRate;
+    fs << "minCornerDistanceRate" << params->minCornerDistanceRate;
+    fs << "minDistanceToBorder" << params->minDistanceToBorder;
+    fs << "minMarkerDistanceRate" << params->minMarkerDistanceRate;
+    fs << "cornerRefinementMethod" << params->cornerRefinementMethod;
+    fs << "cornerRefinementWinSize" << params->cornerRefinementWinSize;
+    fs << "cornerRefinementMaxIterations" << params->cornerRefinementMaxIterations;
+    fs << "cornerRefinementMinAccuracy" << params->cornerRefinementMinAccuracy;
+    fs << "markerBorderBits" << params->markerBorderBits;
+    fs << "perspectiveRemovePixelPerCell" << params->perspectiveRemovePixelPerCell;
+    fs << "perspectiveRemoveIgnoredMarginPerCell" << params->perspectiveRemoveIgnoredMarginPerCell;
+    fs << "maxErroneousBitsInBorderRate" << params->maxErroneousBitsInBorderRate;
+    fs << "minOtsuStdDev" << params->minOtsuStdDev;
+    fs << "errorCorrectionRate" << params->errorCorrectionRate;
+    return true;
+}
+
+// Get a dictionary with only the markers with the given IDs, numbered in the order they are given
+// Detected markers get their position in the list as their ID, so TrackerConfig::dictionaryIDs
+// must be set to the list to turn them back into marker IDs
+Ptr<aruco::Dictionary> restrictDictionary(const Ptr<aruco::Dictionary>& dictionary, const vector<int>& ids) {
+    if(ids.empty())
+        return dictionary;
+
+    const Mat& bytesList = dictionary->bytesList;
+    Mat restrictedBytes((int) ids.size(), bytesList.cols, bytesList.type());
+    for(size_t i = 0; i < ids.size(); ++i) {
+        bytesList.row(ids[i]).copyTo(restrictedBytes.row((int) i));
+    }
+
+    return makePtr<aruco::Dictionary>(restrictedBytes, dictionary->markerSize, dictionary->maxCorrectionBits);
+}
+
+// Label the calling thread in the trace, if the config has a profiler with a trace recorder
+void nameProfiledThread(const TrackerConfig& config, const char* name) {
+    if(config.profiler != nullptr) {
+        config.profiler->nameThread(name);
+    }
+}
+
+// Corners of a marker in its own frame, one per row in the order detection gives them,
+// as used by aruco::estimatePoseSingleMarkers
+Matx43f markerObjectPoints(float markerLength) {
+    float halfLength = markerLength * 0.5f;
+    return Matx43f(-halfLength, halfLength, 0,
+                   halfLength, halfLength, 0,
+                   halfLength, -halfLength, 0,
+                   -halfLength, -halfLength, 0);
+}
+
+// Estimate the pose of one marker from its image corners
+void solveMarkerPose(const TrackerConfig& config, const vector<Point2f>& corners, Vec3d& rvec,
+                     Vec3d& tvec) {
+    Matx43f markerPoints = markerObjectPoints(config.markerLength);
+    Mat markerPointsMat(4, 1, CV_32FC3, markerPoints.val);
+
+    // Corners undistorted by the camera model have no distortion and a focal length of 1
+    if(config.cameraModel != nullptr) {
+        Point2f normalizedCorners[4];
+        config.cameraModel->undistort(corners.data(), normalizedCorners, 4);
+        Mat normalizedCornersMat(4, 1, CV_32FC2, normalizedCorners);
+        solvePnP(markerPointsMat, normalizedCornersMat, Matx33d::eye(), noArray(), rvec, tvec);
+        return;
+    }
+
+    solvePnP(markerPointsMat, corners, config.camMatrix, config.distCoeffs, rvec, tvec);
+}
+
+// Estimate the pose and image position of each detected marker, solving each from scratch
+void estimateFramePose(const TrackerConfig& config, FrameState& frame) {
+    if(!config.estimatePose || frame.ids.size() == 0)
+        return;
+
+    ScopedStageTimer timer(config.profiler, STAGE_POSE, frame.index);
+
+    int numIDs = frame.ids.size();
+
+    // Solve each marker the same way estimatePoseSingleMarkers does, unless detection locked
+    // the pose of the base marker
+    // Frames are not passed in order here, so detection never reuses the markers of a last frame
+    frame.rvecs.resize(numIDs);
+    frame.tvecs.resize(numIDs);
+
+    for(int i = 0; i < numIDs; ++i) {
+        if(frame.baseLocked && frame.ids[i] == 0) {
+            frame.rvecs[i] = frame.baseRvec;
+            frame.tvecs[i] = frame.baseTvec;
+            continue;
+        }
+
+        ScopedTraceEvent event(config.profiler, "solvePnP", "id", frame.ids[i]);
+        solveMarkerPose(config, frame.corners[i], frame.rvecs[i], frame.tvecs[i]);
+    }
+
+    projectMarkerOrigins(config, frame);
+}
+
+// Project the origin of each marker with an estimated pose into the image
+void projectMarkerOrigins(const TrackerConfig& config, FrameState& frame) {
+    int numIDs = frame.ids.size();
+    frame.originImagePoints.resize(numIDs);
+
+    // A marker's origin is at its translation in camera coordinates, so the origins of all
+    // markers are projected in one call with no rotation or translation
+    // Origins live in the frame arena, so steady-state frames do not allocate
+    Point3f* origins = frame.arena.allocate<Point3f>(numIDs);
+    for(int i = 0; i < numIDs; ++i) {
+        const Vec3d& tvec = frame.tvecs[i];
+        origins[i] = Point3f((float) tvec[0], (float) tvec[1], (float) tvec[2]);
+    }
+    Mat originsMat(numIDs, 1, CV_32FC3, origins);
+    Mat imagePointsMat(numIDs, 1, CV_32FC2, frame.originImagePoints.data());
+
+    ScopedTraceEvent event(config.profiler, "projectPoints", "markers", numIDs);
+    projectPoints(originsMat, Vec3d(0, 0, 0), Vec3d(0, 0, 0), config.camMatrix, config.distCoeffs,
+                  imagePointsMat);
+}
+
+// Collect marker data by slot and calculate joint angles
+void computeFrameKinematics(const TrackerConfig& config, FrameState& frame) {
+    FrameState* frames[] = {&frame};
+    computeBatchKinematics(config, frames, 1, frame.arena);
+}
+
+// Collect marker data by slot and calculate joint angles for several frames at once, so the
+// rotations of every marker and the angles of every joint in the batch are each calculated by
+// one kernel call, with scratch space taken from the given arena
+// The batch is timed as one kinematics step of its first frame
+void computeBatchKinematics(const TrackerConfig& config, FrameState* const* frames, size_t count,
+                            FrameArena& arena) {
+    if(count == 0)
+        return;
+
+    ScopedStageTimer timer(config.profiler, STAGE_KINEMATICS, frames[0]->index);
+
+    const JointGraph& graph = config.jointGraph;
+    size_t numMarkers = graph.numMarkers();
+    size_t numJoints = graph.numJoints();
+
+    size_t numIDs = 0;
+    for(size_t f = 0; f < count; ++f) {
+        FrameState& frame = *frames[f];
+        frame.jointAngles.assign(numJoints, 0.0f);
+        frame.anglesDetected.assign(numJoints, false);
+        frame.pointsDetected.assign(numMarkers, false);
+        frame.markerAngles.assign(numMarkers, Vec3f());
+        frame.jointPoints.assign(numMarkers, Vec3f());
+        frame.jointImagePoints.assign(numMarkers, Point2f());
+        numIDs += frame.ids.size();
+    }
+
+    if(!config.estimatePose || numIDs == 0)
+        return;
+
+    // Rotation vectors and angles of every marker in the batch, one array per coordinate
+    float* rotations = arena.allocate<float>(3 * numIDs);
+    float* eulerAngles = arena.allocate<float>(3 * numIDs);
+    size_t marker = 0;
+    for(size_t f = 0; f < count; ++f) {
+        for(const Vec3d& rvec : frames[f]->rvecs) {
+            rotations[marker] = (float) rvec[0];
+            rotations[numIDs + marker] = (float) rvec[1];
+            rotations[2 * numIDs + marker] = (float) rvec[2];
+            ++marker;
+        }
+    }
+    rotationVectorsToEuler(rotations, rotations + numIDs, rotations + 2 * numIDs, eulerAngles,
+                           eulerAngles + numIDs, eulerAngles + 2 * numIDs, numIDs);
+
+    // Marker positions by slot, one array per coordinate, with missing markers left at the origin
+    // The markers of frame f start at point f * numMarkers
+    size_t numPoints = count * numMarkers;
+    float* points = arena.allocate<float>(3 * numPoints);
+    fill(points, points + 3 * numPoints, 0.0f);
+
+    marker = 0;
+    for(size_t f = 0; f < count; ++f) {
+        FrameState& frame = *frames[f];
+
+        for(size_t i = 0; i < frame.ids.size(); ++i, ++marker) {
+            int slot = graph.slotOf(frame.ids[i]);
+
+            // Collect marker data if its ID is tracked
+            if(slot >= 0) {
+                frame.jointPoints[slot] = frame.tvecs[i];
+                frame.jointImagePoints[slot] = frame.originImagePoints[i];
+                frame.pointsDetected[slot] = true;
+                frame.markerAngles[slot] = Vec3f(eulerAngles[marker], eulerAngles[numIDs + marker],
+                                                 eulerAngles[2 * numIDs + marker]);
+
+                size_t point = f * numMarkers + slot;
+                points[point] = frame.jointPoints[slot][0];
+                points[numPoints + point] = frame.jointPoints[slot][1];
+                points[2 * numPoints + point] = frame.jointPoints[slot][2];
+            }
+        }
+    }
+
+    // Joints of every frame, using the points of their own frame
+    size_t numBatchJoints = count * numJoints;
+    int* jointPoints = arena.allocate<int>(3 * numBatchJoints);
+    for(size_t f = 0; f < count; ++f) {
+        int firstPoint = (int) (f * numMarkers);
+        int* frameJointPoints = jointPoints + f * numJoints;
+        for(size_t j = 0; j < numJoints; ++j) {
+            frameJointPoints[j] = firstPoint + graph.firstSlots[j];
+            frameJointPoints[numBatchJoints + j] = firstPoint + graph.vertexSlots[j];
+            frameJointPoints[2 * numBatchJoints + j] = firstPoint + graph.lastSlots[j];
+        }
+    }
+
+    // Every joint of the batch is calculated at once, and only kept if its points were detected
+    float* angles = arena.allocate<float>(7 * numBatchJoints);
+    float* scratch[6];
+    for(int i = 0; i < 6; ++i) {
+        scratch[i] = angles + (i + 1) * numBatchJoints;
+    }
+    computeJointAngles(points, points + numPoints, points + 2 * numPoints, jointPoints,
+                       jointPoints + numBatchJoints, jointPoints + 2 * numBatchJoints, scratch, angles,
+                       numBatchJoints);
+
+    for(size_t f = 0; f < count; ++f) {
+        FrameState& frame = *frames[f];
+
+        for(size_t j = 0; j < numJoints; ++j) {
+            // Check that the points needed for the current angle are detected
+            frame.anglesDetected[j] = (frame.pointsDetected[graph.firstSlots[j]] &&
+                                       frame.pointsDetected[graph.vertexSlots[j]] &&
+                                       frame.pointsDetected[graph.lastSlots[j]]);
+
+            if(frame.anglesDetected[j]) {
+                frame.jointAngles[j] = angles[f * numJoints + j];
+            }
+        }
+    }
+}
+
+// Draw markers, axes, joint angles, and rejected candidates onto a copy of the frame image
+void drawFrame(const TrackerConfig& config, const FrameState& frame, Mat& imageCopy) {
+    ScopedStageTimer timer(config.profiler, STAGE_DRAW, frame.index);
+
+    frame.image.copyTo(imageCopy);
+
+    if(frame.ids.size() > 0) {
+        aruco::drawDetectedMarkers(imageCopy, frame.corners, frame.ids);
+
+        if(config.estimatePose) {
+            int numIDs = frame.ids.size();
+            for(int i = 0; i < numIDs; ++i) {
+                aruco::drawAxis(imageCopy, config.camMatrix, config.distCoeffs, frame.rvecs[i],
+                                frame.tvecs[i], config.markerLength * 0.5f);
+            }
+
+            const JointGraph& graph = config.jointGraph;
+            const vector<Point2f>& jointImagePoints = frame.jointImagePoints;
+
+            // Draw each joint angle
+            for(size_t i = 0; i < graph.numJoints(); ++i) {
+                if(frame.anglesDetected[i]) {
+                    const Point2f& first = jointImagePoints[graph.firstSlots[i]];
+                    const Point2f& vertex = jointImagePoints[graph.vertexSlots[i]];
+                    const Point2f& last = jointImagePoints[graph.lastSlots[i]];
+
+                    // Draw joint angle lines, lines shared by neighboring joints are drawn again
+                    line(imageCopy, vertex, first, Scalar(0, 0, 0), 2);
+                    line(imageCopy, vertex, last, Scalar(0, 0, 0), 2);
+
+                    // Get each line of the joint angle
+                    Vec2f v1 = first - vertex;
+                    Vec2f v2 = last - vertex;
+
+                    // Get point in the middle of the angle
+                    Vec2f bisection = (normalize(v1) + normalize(v2)) * 25.0f;
+                    Point2f p;
+                    p.x = bisection[0] + vertex.x;
+                    p.y = bisection[1] + vertex.y;
+
+                    // Get rounded angle value as a string
+                    string displayText = to_string((int) round(frame.jointAngles[i]));
+
+                    // Center angle text
+                    int baseline = 0;
+                    Size textSize = getTextSize(displayText, 0, 0.5, 2, &baseline);
+                    p.x -= textSize.width / 2.0f;
+                    p.y -= textSize.height / 2.0f;
+
+                    // Display angle text centered in the angle
+                    putText(imageCopy, displayText, p, 0, 0.5, Scalar(255, 255, 255), 2);
+                }
+            }
+        }
+    }
+
+    // Draw rejected marker candidates if needed
+    if(config.showRejected && frame.rejected.size() > 0)
+        aruco::drawDetectedMarkers(imageCopy, frame.rejected, noArray(), Scalar(100, 0, 255));
+}
+
+// Print column titles to a data output file
+// Markers are named by their IDs and joints are numbered in the order they are listed
+void writeOutputHeader(ostream& outputFile, const JointGraph& jointGraph) {
+    outputFile << "Total Time";
+    for(size_t i = 1; i <= jointGraph.numJoints(); ++i) {
+        outputFile << ",Joint " << i << " Angle";
+    }
+    for(int id : jointGraph.markerIDs) {
+        outputFile << ",Marker " << id << " Rotation";
+    }
+    outputFile << endl;
+}
+
+// Write the time, joint angles, and marker rotations of a frame as one row
+void writeOutputRow(ostream& outputFile, const TrackerConfig& config, const FrameState& frame) {
+    ScopedStageTimer timer(config.profiler, STAGE_WRITE, frame.index);
+
+    // Write frame time
+    outputFile << frame.time;
+
+    // Write joint angle data
+    for(size_t i = 0; i < config.jointGraph.numJoints(); ++i) {
+        outputFile << ",";
+        if(frame.anglesDetected[i]) {
+            outputFile << frame.jointAngles[i];
+        }
+    }
+
+    // Write marker rotation data
+    for(size_t i = 0; i < config.jointGraph.numMarkers(); ++i) {
+        outputFile << ",";
+        if(frame.pointsDetected[i]) {
+            outputFile << "\"" << frame.markerAngles[i][0] << "," << frame.markerAngles[i][1]
+                       << "," << frame.markerAngles[i][2] << "\"";
+        }
+    }
+
+    outputFile << endl;
+}
@@ -0,0 +1,164 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * tracking.h
+ * Contains the per-frame processing steps used by the pipeline stages:
+ * pose estimation, joint angle calculation, drawing, and output.
+ */
+
+#pragma once
+
+#include "camera.h"
+#include "governor.h"
+#include "joints.h"
+#include "profiler.h"
+#include <opencv2/core.hpp>
+#include <opencv2/aruco.hpp>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Settings and calibration data shared by every processing stage
+struct TrackerConfig {
+    cv::Ptr<cv::aruco::Dictionary> dictionary;
+    // Marker ID of each marker of a dictionary restricted to a list of IDs, empty if the
+    // dictionary's own marker numbers are the IDs
+    std::vector<int> dictionaryIDs;
+    cv::Ptr<cv::aruco::DetectorParameters> detectorParams;
+    cv::Mat camMatrix;
+    cv::Mat distCoeffs;
+    float markerLength = 0.0f;
+    JointGraph jointGraph; // Tracked markers and the joints between them
+    bool estimatePose = false;
+    bool showRejected = false;
+    // Frames between full-frame searches when tracking marker regions, 0 searches every full frame
+    int fullScanInterval = 0;
+    // Padding around the last position of each tracked marker, as a fraction of its size
+    float regionPadding = 0.75f;
+    // Markers are found in a copy of each frame shrunk by this factor, then refined at full resolution
+    int detectionScale = 1;
+    // Full-frame searches are split into this many tiles across and down, searched in parallel
+    int detectionTiles = 1;
+    // Overlap between neighboring tiles, as a fraction of the frame size
+    float tileOverlap = 0.1f;
+    // Frames between marker searches when following corners with optical flow, 0 searches every frame
+    int flowSearchInterval = 0;
+    // Frames the base marker must stay still before its pose is locked, 0 never locks it
+    int baseLockFrames = 0;
+    // Largest change in gray level of a shrunk frame that still counts as unchanged, so the
+    // results of the last processed frame are reused, 0 processes every frame
+    float motionThreshold = 0.0f;
+    // Poses of markers seen in the last frame are refined from their last pose instead of solved
+    bool warmStartPoses = false;
+    // Undistorts corners by grid lookup when not null, so poses are solved in normalized coordinates
+    const CameraModel* cameraModel = nullptr;
+    Profiler* profiler = nullptr; // Times each step when not null
+    const QualityGovernor* governor = nullptr; // Lowers detection and drawing quality when not null
+};
+
+// Bump allocator for variable-size scratch data of one frame
+// Everything is released at once by reset, and memory only grows until it fits the largest frame
+class FrameArena {
+public:
+    explicit FrameArena(size_t initialCapacity = 4096);
+
+    // Get uninitialized space for count objects, valid until the next reset
+    template<typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+        return static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+    }
+
+    void reset();
+    size_t capacity() const;
+
+private:
+    void* allocateBytes(size_t size, size_t alignment);
+
+    std::unique_ptr<unsigned char[]> block;
+    size_t blockSize = 0;
+    size_t used = 0;
+
+    // Space given out after the block ran out, merged into the block on the next reset
+    std::vector<std::unique_ptr<unsigned char[]>> overflow;
+    size_t overflowBytes = 0;
+};
+
+// Image, detected markers, and joint angle data for a single frame
+// Frame states are reused for many frames, so their vectors keep their capacity between frames
+struct FrameState {
+    // Clear per-frame results without releasing their memory
+    // Corners are overwritten by detection, so they keep their inner vectors
+    void reset();
+
+    FrameArena arena;
+
+    cv::Mat image;
+    int index = 0;     // Number of frames delivered before this one
+    double time = 0.0; // Seconds since capture started, or media time for video files
+    // Longest time a pipeline stage spent working on this frame, not counting time spent waiting
+    // for input, a free frame, or queue space, so the quality governor only sees stage work
+    int64_t slowestStageTicks = 0;
+
+    // Detection and pose estimation results, one entry per detected marker
+    std::vector<int> ids;
+    std::vector<std::vector<cv::Point2f>> corners, rejected;
+    std::vector<cv::Vec3d> rvecs, tvecs;
+    std::vector<cv::Point2f> originImagePoints;
+
+    // Set by detection when the base marker (ID 0) is held still, so its pose is not solved again
+    bool baseLocked = false;
+    cv::Vec3d baseRvec, baseTvec;
+    // Set by detection when the image did not change and it got the markers of the last frame,
+    // so pose estimation gives them the poses of the last frame
+    bool posesReused = false;
+
+    // Joint data, indexed by marker slot in the joint graph or joint number
+    std::vector<float> jointAngles;
+    std::vector<bool> anglesDetected;
+    std::vector<bool> pointsDetected;
+    std::vector<cv::Vec3f> markerAngles;
+    std::vector<cv::Vec3f> jointPoints;
+    std::vector<cv::Point2f> jointImagePoints;
+};
+
+// Read camera parameters from a given file and store them in passed variables
+bool readCameraParameters(std::string filename, cv::Mat& camMatrix, cv::Mat& distCoeffs);
+// Read detector parameters from a given file and store them in passed variables
+bool readDetectorParameters(std::string filename, cv::Ptr<cv::aruco::DetectorParameters>& params);
+// Write detector parameters to a file in the format read by readDetectorParameters
+bool writeDetectorParameters(std::string filename, const cv::Ptr<cv::aruco::DetectorParameters>& params);
+// Get a dictionary with only the markers with the given IDs, numbered in the order they are given
+cv::Ptr<cv::aruco::Dictionary> restrictDictionary(const cv::Ptr<cv::aruco::Dictionary>& dictionary,
+                                                  const std::vector<int>& ids);
+
+// Label the calling thread in the trace, if the config has a profiler with a trace recorder
+void nameProfiledThread(const TrackerConfig& config, const char* name);
+
+// Corners of a marker in its own frame, one per row in the order detection gives them
+cv::Matx43f markerObjectPoints(float markerLength);
+// Estimate the pose of one marker from its image corners
+void solveMarkerPose(const TrackerConfig& config, const std::vector<cv::Point2f>& corners,
+                     cv::Vec3d& rvec, cv::Vec3d& tvec);
+// Estimate the pose and image position of each detected marker, solving each from scratch
+void estimateFramePose(const TrackerConfig& config, FrameState& frame);
+// Project the origin of each marker with an estimated pose into the image
+void projectMarkerOrigins(const TrackerConfig& config, FrameState& frame);
+// Collect marker data by slot and calculate joint angles
+void computeFrameKinematics(const TrackerConfig& config, FrameState& frame);
+// Collect marker data by slot and calculate joint angles for several frames at once, so the
+// rotations of every marker and the angles of every joint in the batch are each calculated by
+// one kernel call, with scratch space taken from the given arena
+void computeBatchKinematics(const TrackerConfig& config, FrameState* const* frames, size_t count,
+                            FrameArena& arena);
+// Draw markers, axes, joint angles, and rejected candidates onto a copy of the frame image
+void drawFrame(const TrackerConfig& config, const FrameState& frame, cv::Mat& imageCopy);
+
+// Print column titles to a data output file
+// Markers are named by their IDs and joints are numbered in the order they are listed
+void writeOutputHeader(std::ostream& outputFile, const JointGraph& jointGraph);
+// Write the time, joint angles, and marker rotations of a frame as one row
+void writeOutputRow(std::ostream& outputFile, const TrackerConfig& config, const FrameState& frame);
@@ -0,0 +1,294 @@
+/* Aden Prince
+ * HiMER Lab at U. of Illinois, Chicago
+ * ArUco Marker Joint Tracker
+ *
+ * tuner.cpp
+ * Searches marker detector parameters on a recorded video for the best trade-offs between
+ * detection time and how many of the expected markers are found in each frame.
+ * Parameter sets that no other set beats on both are written out as detector parameter files.
+ */
+
+#include "../detection.h"
+#include "../profiler.h"
+#include "../tracking.h"
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/aruco.hpp>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+    const char* about = "Marker detector parameter tuner";
+    const char* keys =
+        "{h        |              | Display help information }"
+        "{v        |              | Input video filename }"
+        "{d        | 0            | ArUco marker dictionary, numbered as in the tracker (-d) }"
+        "{nj       | 1            | Number of joints, markers 0 to nj + 1 are expected in every frame }"
+        "{dp       |              | File of marker detector parameters to start from }"
+        "{f        | 150          | Largest number of frames to decode and search }"
+        "{step     | 1            | Use every Nth frame of the video }"
+        "{w        | 0            | Worker threads evaluating parameter sets, 0 uses one per core }"
+        "{o        | tuned_params | Prefix of the detector parameter files that are written }"
+        "{csv      |              | CSV filename for the results of every parameter set }";
+
+    // Adaptive threshold window sizes, as smallest, largest, and step
+    const int thresholdWindows[][3] = {{3, 23, 10}, {3, 13, 10}, {5, 25, 10}, {3, 33, 10},
+                                       {7, 7, 10}, {13, 13, 10}, {23, 23, 10}};
+    const double thresholdConstants[] = {7, 10};
+    const double minPerimeterRates[] = {0.01, 0.03, 0.05, 0.1};
+    const double approxAccuracyRates[] = {0.03, 0.05, 0.08};
+    const int refinementMethods[] = {aruco::CORNER_REFINE_NONE, aruco::CORNER_REFINE_SUBPIX,
+                                     aruco::CORNER_REFINE_CONTOUR};
+
+    // A set of detector parameters and how it did on the video
+    struct Candidate {
+        Ptr<aruco::DetectorParameters> params;
+        double meanMs = 0.0;
+        double p99Ms = 0.0;
+        double recall = 0.0; // Mean fraction of the expected markers found per frame
+        bool optimal = false;
+    };
+
+    // Every combination of the searched values, with the other parameters left as given
+    vector<Candidate> makeCandidates(const Ptr<aruco::DetectorParameters>& baseParams) {
+        vector<Candidate> candidates;
+        for(const int* window : thresholdWindows) {
+            for(double constant : thresholdConstants) {
+                for(double perimeterRate : minPerimeterRates) {
+                    for(double accuracyRate : approxAccuracyRates) {
+                        for(int method : refinementMethods) {
+                            Candidate candidate;
+                            candidate.params = makePtr<aruco::DetectorParameters>(*baseParams);
+                            candidate.params->adaptiveThreshWinSizeMin = window[0];
+                            candidate.params->adaptiveThreshWinSizeMax = window[1];
+                            candidate.params->adaptiveThreshWinSizeStep = window[2];
+                            candidate.params->adaptiveThreshConstant = constant;
+                            candidate.params->minMarkerPerimeterRate = perimeterRate;
+                            candidate.params->polygonalApproxAccuracyRate = accuracyRate;
+                            candidate.params->cornerRefinementMethod = method;
+                            candidates.push_back(candidate);
+                        }
+                    }
+                }
+            }
+        }
+        return candidates;
+    }
+
+    // Detect markers in every frame with the candidate's parameters, timing each frame
+    void evaluate(const TrackerConfig& baseConfig, const vector<Mat>& frames, int numExpected,
+                  Candidate& candidate) {
+        TrackerConfig config = baseConfig;
+        config.detectorParams = candidate.params;
+
+        // Frames are far apart in the video, so markers are not tracked between them
+        MarkerDetector markerDetector(config, false);
+        FrameState state;
+        LatencyHistogram latency;
+        vector<bool> found(numExpected);
+        double totalRecall = 0.0;
+
+        // The first frame is searched once untimed, so buffers are already allocated
+        for(int i = -1; i < (int) frames.size(); ++i) {
+            state.reset();
+            state.image = frames[max(i, 0)];
+            state.index = i;
+
+            int64_t start = nowNanoseconds();
+            markerDetector.detect(state);
+            int64_t end = nowNanoseconds();
+
+            if(i < 0)
+                continue;
+            latency.record(end - start);
+
+            // Markers found twice still only count once
+            fill(found.begin(), found.end(), false);
+            int numFound = 0;
+            for(int id : state.ids) {
+                if(id >= 0 && id < numExpected && !found[id]) {
+                    found[id] = true;
+                    ++numFound;
+                }
+            }
+            totalRecall += (double) numFound / numExpected;
+        }
+
+        candidate.meanMs = latency.mean() / 1e6;
+        candidate.p99Ms = latency.percentile(0.99) / 1e6;
+        candidate.recall = totalRecall / frames.size();
+    }
+
+    // Mark the candidates that no other candidate beats on both recall and mean time,
+    // and return them from fastest to slowest
+    vector<Candidate*> findParetoFront(vector<Candidate>& candidates) {
+        vector<Candidate*> sorted;
+        for(Candidate& candidate : candidates) {
+            sorted.push_back(&candidate);
+        }
+        sort(sorted.begin(), sorted.end(), [](const Candidate* a, const Candidate* b) {
+            return a->meanMs != b->meanMs ? a->meanMs < b->meanMs : a->recall > b->recall;
+        });
+
+        // Going from fastest to slowest, a candidate is only worth its time if it finds more
+        vector<Candidate*> front;
+        double bestRecall = -1.0;
+        for(Candidate* candidate : sorted) {
+            if(candidate->recall > bestRecall) {
+                candidate->optimal = true;
+                front.push_back(candidate);
+                bestRecall = candidate->recall;
+            }
+        }
+        return front;
+    }
+
+    void writeResultsHeader(ostream& out) {
+        out << "Win Min,Win Max,Win Step,Thresh Constant,Min Perimeter Rate,Approx Accuracy Rate,"
+               "Corner Refinement,Mean (ms),p99 (ms),Recall,Pareto Optimal" << endl;
+    }
+
+    void writeResultRow(ostream& out, const Candidate& candidate) {
+        const aruco::DetectorParameters& params = *candidate.params;
+        out << params.adaptiveThreshWinSizeMin << "," << params.adaptiveThreshWinSizeMax << ","
+            << params.adaptiveThreshWinSizeStep << "," << params.adaptiveThreshConstant << ","
+            << params.minMarkerPerimeterRate << "," << params.polygonalApproxAccuracyRate << ","
+            << params.cornerRefinementMethod << "," << candidate.meanMs << "," << candidate.p99Ms << ","
+            << candidate.recall << "," << (candidate.optimal ? 1 : 0) << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    CommandLineParser parser(argc, argv, keys);
+    parser.about(about);
+
+    if(parser.has("h") || !parser.has("v")) {
+        parser.printMessage();
+        return 0;
+    }
+
+    int dictionaryID = parser.get<int>("d");
+    int numJoints = parser.get<int>("nj");
+    int maxFrames = parser.get<int>("f");
+    int frameStep = parser.get<int>("step");
+    int numWorkers = parser.get<int>("w");
+    string outputPrefix = parser.get<string>("o");
+
+    Ptr<aruco::DetectorParameters> baseParams = aruco::DetectorParameters::create();
+    if(parser.has("dp")) {
+        bool readOk = readDetectorParameters(parser.get<string>("dp"), baseParams);
+        if(!readOk) {
+            cerr << "Invalid detector parameters file" << endl;
+            return 1;
+        }
+    }
+
+    if(!parser.check()) {
+        parser.printErrors();
+        return 1;
+    }
+
+    if(dictionaryID < 0 || dictionaryID > aruco::DICT_APRILTAG_36h11) {
+        cerr << "Unknown dictionary " << dictionaryID << endl;
+        return 1;
+    }
+    if(numJoints < 0 || maxFrames < 1 || frameStep < 1 || numWorkers < 0) {
+        cerr << "Frames (-f) and frame step (-step) must be positive and joints (-nj) and "
+                "worker threads (-w) cannot be negative" << endl;
+        return 1;
+    }
+    if(numWorkers == 0) {
+        numWorkers = max((int) thread::hardware_concurrency(), 1);
+    }
+
+    VideoCapture inputVideo;
+    inputVideo.open(parser.get<string>("v"));
+    if(!inputVideo.isOpened()) {
+        cerr << "Video file \"" << parser.get<string>("v") << "\" failed to open" << endl;
+        return 1;
+    }
+
+    // Frames are decoded once and shared by every worker, kept in grayscale since detection
+    // converts to grayscale first anyway, which also halves their memory
+    vector<Mat> frames;
+    Mat image;
+    for(int i = 0; (int) frames.size() < maxFrames && inputVideo.read(image); ++i) {
+        if(i % frameStep != 0)
+            continue;
+        Mat gray;
+        cvtColor(image, gray, COLOR_BGR2GRAY);
+        frames.push_back(gray);
+    }
+    if(frames.empty()) {
+        cerr << "No frames could be read from the video" << endl;
+        return 1;
+    }
+
+    TrackerConfig config;
+    int numExpected = numJoints + 2;
+    Ptr<aruco::Dictionary> dictionary =
+        aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(dictionaryID));
+    // Only the IDs in the joint graph are searched for and mapped back, as in the tracker
+    config.jointGraph = makeChainGraph(numJoints);
+    config.dictionary = restrictDictionary(dictionary, config.jointGraph.markerIDs);
+    config.dictionaryIDs = config.jointGraph.markerIDs;
+
+    vector<Candidate> candidates = makeCandidates(baseParams);
+    cout << "Evaluating " << candidates.size() << " parameter sets on " << frames.size()
+         << " frames with " << numWorkers << " workers" << endl;
+
+    // Each evaluation runs on one core, so evaluations do not compete for OpenCV's threads
+    // and their times are comparable
+    setNumThreads(1);
+
+    atomic<size_t> nextCandidate(0);
+    vector<thread> workers;
+    for(int i = 0; i < numWorkers; ++i) {
+        workers.emplace_back([&]() {
+            for(size_t c = nextCandidate++; c < candidates.size(); c = nextCandidate++) {
+                evaluate(config, frames, numExpected, candidates[c]);
+            }
+        });
+    }
+    for(thread& worker : workers) {
+        worker.join();
+    }
+
+    vector<Candidate*> front = findParetoFront(candidates);
+
+    if(parser.has("csv")) {
+        ofstream csvFile(parser.get<string>("csv"));
+        if(!csvFile.is_open()) {
+            cerr << "File \"" << parser.get<string>("csv") << "\" failed to open" << endl;
+            return 1;
+        }
+        writeResultsHeader(csvFile);
+        for(const Candidate& candidate : candidates) {
+            writeResultRow(csvFile, candidate);
+        }
+    }
+
+    // Parameter files are numbered from fastest to most complete
+    cout << "Pareto-optimal parameter sets, from fastest to most markers found:" << endl;
+    writeResultsHeader(cout);
+    for(size_t i = 0; i < front.size(); ++i) {
+        writeResultRow(cout, *front[i]);
+
+        stringstream filename;
+        filename << outputPrefix << "_" << i + 1 << ".yml";
+        if(!writeDetectorParameters(filename.str(), front[i]->params)) {
+            cerr << "File \"" << filename.str() << "\" failed to open" << endl;
+            return 1;
+        }
+        cout << "Written to " << filename.str() << endl;
+    }
+
+    return 0;
+}